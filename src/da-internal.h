@@ -141,8 +141,10 @@ struct audchannel { /* describes information collected from an audio stream */
     struct audiodesc ad,adwarn; // use for quant and channels
 };
 
-struct vob { /* one entry created for each source in each pgc */
+struct vob { /* one entry created for each distinct source in each vobgroup */
     char *fname; /* name of input file, copied from source */
+    dev_t fdev; /* identifies input file, so it is recognized under other names */
+    ino_t fino; /* (both 0 if it could not be stat'ed) */
     int numvobus; /* used portion of vobu array */
     int maxvobus; /* allocated size of vobu array */
     int vobid,numcells;
@@ -285,10 +287,11 @@ unsigned char *vm_compile
     const struct workset *ws,
     const struct pgcgroup *curgroup,
     const struct pgc *curpgc,
-    const struct vm_statement *cs,
+    struct vm_statement *cs,
     vtypes ismenu
   );
-  /* compiles the parse tree cs into actual VM instructions. */
+  /* compiles the parse tree cs into actual VM instructions. The tree may be
+    simplified in place. */
 void vm_optimize(const unsigned char *obuf, unsigned char *buf, unsigned char **end);
   /* does various peephole optimizations on the part of obuf from buf to *end. */
 struct vm_statement *vm_parse(const char *b);
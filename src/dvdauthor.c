@@ -1299,11 +1299,29 @@ static void colorinfo_free(struct colorinfo *ci)
       } /*if*/
   } /*colorinfo_free*/
 
+static void getfileid(const char *fname, dev_t *dev, ino_t *ino)
+  /* identifies the input file fname by device and inode, or returns zeroes if it
+    cannot be stat'ed (e.g. an input pipe). */
+  {
+    struct stat statinfo;
+    if (stat(fname, &statinfo) == 0)
+      {
+        *dev = statinfo.st_dev;
+        *ino = statinfo.st_ino;
+      }
+    else
+      {
+        *dev = 0;
+        *ino = 0;
+      } /*if*/
+  } /*getfileid*/
+
 static struct vob *vob_new(const char *fname,struct pgc *progchain)
 {
     struct vob *v=malloc(sizeof(struct vob));
     memset(v,0,sizeof(struct vob));
     v->fname=strdup(fname);
+    getfileid(fname, &v->fdev, &v->fino);
     v->progchain=progchain;
     return v;
 }
@@ -1344,22 +1362,117 @@ static void vobgroup_free(struct vobgroup *vg)
       } /*if*/
   } /*vobgroup_free*/
 
-static void vobgroup_addvob(struct vobgroup *pg, struct pgc *p, struct source *s)
+static bool samestring(const char *a, const char *b)
+  {
+    return a == b || (a != 0 && b != 0 && !strcmp(a, b));
+  } /*samestring*/
+
+static bool statement_equal(const struct vm_statement *a, const struct vm_statement *b)
+  /* are the parse trees a and b identical? */
   {
-    const bool forcenew = p->numbuttons != 0;
-    if (!forcenew)
+    for (;;)
       {
-      /* Reuse a previously-created vob element with the same input file name,
-        if one can be found. This is not tried if buttons are present--is that
-        because of colour-remapping issues? */
-        int i;
-        for (i = 0; i < pg->numvobs; i++)
-            if (!strcmp(pg->vobs[i]->fname, s->fname) && pg->vobs[i]->progchain->numbuttons == 0)
-              {
-                s->vob = pg->vobs[i];
-                return;
-              } /*if*/
-      } /*if*/
+        if (a == 0 || b == 0)
+            return a == b;
+        if
+          (
+                a->op != b->op
+            ||
+                a->i1 != b->i1
+            ||
+                a->i2 != b->i2
+            ||
+                a->i3 != b->i3
+            ||
+                a->i4 != b->i4
+            ||
+                !samestring(a->s1, b->s1)
+            ||
+                !samestring(a->s2, b->s2)
+            ||
+                !samestring(a->s3, b->s3)
+            ||
+                !samestring(a->s4, b->s4)
+            ||
+                !statement_equal(a->param, b->param)
+          )
+            return false;
+        a = a->next;
+        b = b->next;
+      } /*for*/
+  } /*statement_equal*/
+
+static bool vob_matches(const struct vob *v, const char *fname, dev_t fdev, ino_t fino)
+  /* is v made from the input file fname, which has the specified file ID? */
+  {
+    return
+            !strcmp(v->fname, fname)
+        ||
+            (fino != 0 && v->fino == fino && v->fdev == fdev);
+  } /*vob_matches*/
+
+static bool pgc_samebuttons(const struct pgc *a, const struct pgc *b)
+  /* can PGCs a and b share the same VOB? This requires them to generate the
+    same PCI packets: the same button names and commands, compiled against the
+    same pgcgroup, the same subpicture mapping, and the same source files, since
+    these determine which subpicture streams end up in the VOB. */
+  {
+    int i;
+    if (a->numbuttons != b->numbuttons)
+        return false;
+    if (a->numbuttons == 0 || a == b)
+        return true;
+    if
+      (
+            a->pgcgroup != b->pgcgroup
+        ||
+            a->numsources != b->numsources
+        ||
+            memcmp(a->subpmap, b->subpmap, sizeof a->subpmap) != 0
+      )
+        return false;
+    for (i = 0; i < a->numsources; i++)
+      /* all of a's sources already have their vobs, b's may not yet */
+      {
+        dev_t fdev;
+        ino_t fino;
+        getfileid(b->sources[i]->fname, &fdev, &fino);
+        if (!vob_matches(a->sources[i]->vob, b->sources[i]->fname, fdev, fino))
+            return false;
+      } /*for*/
+    for (i = 0; i < a->numbuttons; i++)
+        if
+          (
+                strcmp(a->buttons[i].name, b->buttons[i].name)
+            ||
+                !statement_equal(a->buttons[i].commands, b->buttons[i].commands)
+          )
+            return false;
+    return true;
+  } /*pgc_samebuttons*/
+
+static void vobgroup_addvob(struct vobgroup *pg, struct pgc *p, struct source *s)
+  /* Sets s->vob to a vob element for the input file of s, reusing a previously-created
+    one for the same file if possible, so the file is only scanned and written once and
+    all the PGCs referencing it share the same cells. This is only done for menus with
+    buttons if the buttons are the same, since the button definitions end up in the PCI
+    packets in the VOB. */
+  {
+    dev_t fdev;
+    ino_t fino;
+    int i;
+    getfileid(s->fname, &fdev, &fino);
+    for (i = 0; i < pg->numvobs; i++)
+        if
+          (
+                vob_matches(pg->vobs[i], s->fname, fdev, fino)
+            &&
+                pgc_samebuttons(pg->vobs[i]->progchain, p)
+          )
+          {
+            s->vob = pg->vobs[i];
+            return;
+          } /*if; for*/
     pg->vobs = realloc(pg->vobs, (pg->numvobs + 1) * sizeof(struct vob *));
     s->vob = pg->vobs[pg->numvobs++] = vob_new(s->fname, p);
   } /*vobgroup_addvob*/
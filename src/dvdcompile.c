@@ -58,7 +58,7 @@ static int swapcompare(int compareop)
     if (compareop < 4) /* BC, EQ, NE unchanged */
         return compareop;
     else
-        return compareop ^ 3; /* GE <=> LT, GT <=> LE */
+        return compareop ^ 2; /* GE <=> LE, GT <=> LT */
   } /*swapcompare*/
 
 static bool compile_usesreg(const struct vm_statement *cs, int target)
@@ -66,9 +66,7 @@ static bool compile_usesreg(const struct vm_statement *cs, int target)
   {
     while (cs)
       {
-        if (cs->op == VM_VAL)
-            return cs->i1 == target - 256;
-        if (compile_usesreg(cs->param, target))
+        if (cs->op == VM_VAL ? cs->i1 == target - 256 : compile_usesreg(cs->param, target))
             return true;
         cs = cs->next;
       } /*while*/
@@ -410,8 +408,8 @@ static unsigned char *compilecs
       {
         if (cs->op != VM_NOP)
             lastif = false; /* no need for dummy target for last branch, I'll be providing a real one */
-          /* actually check for VM_NOP is unnecessary so long as no construct will
-            generate one */
+          /* the optimizer turns statements it removes into VM_NOPs, which generate
+            no code, so these must not be taken as providing that target */
         switch (cs->op)
           {
         case VM_SET: /* cs->i1 is destination, cs->param is source */
@@ -537,7 +535,7 @@ static unsigned char *compilecs
           {
             unsigned char * iftrue = buf + 8; /* initially try putting true branch here */
             const unsigned char * iffalse = buf + 16; /* initially try putting false branch here */
-            unsigned char * end = buf + 16; /* initially assuming code will end here */
+            unsigned char * end;
             while (true) /* should loop no more than twice */
               {
                 unsigned char *lp, *ib, *e;
@@ -560,12 +558,12 @@ static unsigned char *compilecs
                     return 0;
               /* at this point, ib is just after the condition test, lp is just after
                 the true branch, and e is just after the end of all the code */
+                end = e;
                 if (ib == iftrue && lp == iffalse)
                     break; /* all fitted nicely */
               /* didn't leave enough room for pieces next to each other, try again */
                 iftrue = ib; /* enough room for condition code */
                 iffalse = lp; /* enough room for true branch */
-                end = e;
               } /*while*/
             buf = end;
             lastif = true; // make sure reference statement is generated
@@ -1543,6 +1541,531 @@ void vm_optimize(const unsigned char *obuf, unsigned char *buf, unsigned char **
       } /*for*/
   } /*vm_optimize*/
 
+/*
+    Expression-level optimization of the parse tree, done before code generation.
+    Each straight-line sequence of statements is scanned keeping track of which
+    GPRMs are known to hold literal values or the values of other expressions,
+    so these can be substituted into later expressions, and which assignments
+    have not been read yet, so they can be removed if overwritten. Anything that
+    can transfer control elsewhere, or be transferred to, ends the sequence.
+
+    Only GPRMs that user code can access are tracked: when allgprm is not set,
+    compileexpr and compilebool use g13-g15 behind my back as temporaries.
+*/
+
+struct exprstate /* what is known about GPRM contents at some point in a statement sequence */
+  {
+    int nrregs; /* how many GPRMs are tracked */
+    int value[16]; /* known literal contents, -1 if unknown */
+    struct vm_statement *avail[16]; /* expression whose value register holds, NULL if none */
+    struct vm_statement *pending[16]; /* assignment to register that hasn't been read yet */
+  };
+
+static void exprstate_reset(struct exprstate *es)
+  /* forgets everything known about register contents. */
+  {
+    int i;
+    es->nrregs = allowallreg ? 16 : 13;
+    for (i = 0; i < 16; i++)
+      {
+        es->value[i] = -1;
+        es->avail[i] = NULL;
+        es->pending[i] = NULL;
+      } /*for*/
+  } /*exprstate_reset*/
+
+static bool exprusesreg(const struct vm_statement *v, int reg)
+  /* does the single expression v (ignoring v->next) reference the specified register. */
+  {
+    return
+        v->op == VM_VAL ?
+            v->i1 == reg - 256
+        :
+            compile_usesreg(v->param, reg);
+  } /*exprusesreg*/
+
+static bool isplainexpr(const struct vm_statement *v)
+  /* does the expression v always give the same result for the same GPRM contents:
+    no random numbers, and no SPRMs, which can change by themselves (e.g. navigation timer). */
+  {
+    if (v->op == VM_VAL)
+        return !issprmval(v);
+    if (v->op == VM_RND)
+        return false;
+    for (v = v->param; v; v = v->next)
+        if (!isplainexpr(v))
+            return false;
+    return true;
+  } /*isplainexpr*/
+
+static bool sameexpr(const struct vm_statement *a, const struct vm_statement *b)
+  /* are expressions a and b (ignoring their next fields) identical. */
+  {
+    if (a->op != b->op)
+        return false;
+    if (a->op == VM_VAL)
+        return a->i1 == b->i1;
+    for (a = a->param, b = b->param; a && b; a = a->next, b = b->next)
+        if (!sameexpr(a, b))
+            return false;
+    return a == b; /* both chains must end at the same time */
+  } /*sameexpr*/
+
+static void forgetreg(struct exprstate *es, int reg)
+  /* forgets what is known about the contents of reg, and about any expressions
+    that depend on its value. */
+  {
+    int i;
+    es->value[reg] = -1;
+    es->avail[reg] = NULL;
+    for (i = 0; i < es->nrregs; i++)
+        if (es->avail[i] && exprusesreg(es->avail[i], reg))
+            es->avail[i] = NULL;
+  } /*forgetreg*/
+
+static void notereads(struct exprstate *es, const struct vm_statement *v)
+  /* notes that expression v reads registers, so any assignments to them are not dead. */
+  {
+    int i;
+    for (i = 0; i < es->nrregs; i++)
+        if (es->pending[i] && exprusesreg(v, i))
+            es->pending[i] = NULL;
+  } /*notereads*/
+
+static void replaceexpr(struct vm_statement **vp, struct vm_statement *v)
+  /* replaces expression *vp with v, keeping its place in any operand chain. */
+  {
+    v->next = vp[0]->next;
+    *vp = v;
+  } /*replaceexpr*/
+
+static struct vm_statement *newval(int i1)
+  /* returns a new VM_VAL expression. */
+  {
+    struct vm_statement * const v = statement_new();
+    v->op = VM_VAL;
+    v->i1 = i1;
+    return v;
+  } /*newval*/
+
+static bool foldop(int op, int a, int b, int *result)
+  /* computes a op b for literal operands. Returns false if the result would
+    depend on how the player handles overflow or division by zero. */
+  {
+    int r;
+    switch (op)
+      {
+    case VM_ADD:
+        r = a + b;
+    break;
+    case VM_SUB:
+        r = a - b;
+    break;
+    case VM_MUL:
+        r = a * b;
+    break;
+    case VM_DIV:
+        if (b == 0)
+            return false;
+        r = a / b;
+    break;
+    case VM_MOD:
+        if (b == 0)
+            return false;
+        r = a % b;
+    break;
+    case VM_AND:
+        r = a & b;
+    break;
+    case VM_OR:
+        r = a | b;
+    break;
+    case VM_XOR:
+        r = a ^ b;
+    break;
+    default:
+        return false;
+      } /*switch*/
+    if (r < 0 || r > 65535)
+        return false;
+    *result = r;
+    return true;
+  } /*foldop*/
+
+static void optimizeexpr(struct exprstate *es, struct vm_statement **vp)
+  /* does constant substitution and folding and common-subexpression elimination
+    on the expression *vp, which may be replaced. */
+  {
+    struct vm_statement *v = *vp, *lit, **pp;
+    int i, r, nrops;
+    bool isassoc;
+    if (v->op == VM_VAL)
+      {
+        if (v->i1 < 0 && v->i1 + 256 < es->nrregs && es->value[v->i1 + 256] >= 0)
+            v->i1 = es->value[v->i1 + 256]; /* register with known contents */
+        return;
+      } /*if*/
+    for (pp = &v->param; *pp; pp = &pp[0]->next)
+        optimizeexpr(es, pp);
+    if (v->op != VM_RND)
+      {
+        isassoc =
+                v->op == VM_ADD
+            ||
+                v->op == VM_MUL
+            ||
+                v->op == VM_AND
+            ||
+                v->op == VM_OR
+            ||
+                v->op == VM_XOR;
+        if (isassoc || v->op == VM_SUB || v->op == VM_DIV)
+          {
+          /* combine literal operands: all of them for associative (and commutative)
+            operators; all after the first for subtraction (a - b - c = a - (b + c));
+            adjacent nonzero ones after the first for division (a / b / c = a / (b * c),
+            but not across a division by zero or by a register that might be zero) */
+            lit = NULL;
+            for (pp = isassoc ? &v->param : &v->param->next; *pp;)
+              {
+                if (pp[0]->op != VM_VAL || pp[0]->i1 < 0 || (v->op == VM_DIV && pp[0]->i1 == 0))
+                  {
+                    if (v->op == VM_DIV)
+                        lit = NULL;
+                  }
+                else
+                  {
+                    if (lit == NULL)
+                        lit = *pp;
+                    else if
+                      (
+                        foldop
+                          (
+                            v->op == VM_SUB ? VM_ADD : v->op == VM_DIV ? VM_MUL : v->op,
+                            lit->i1,
+                            pp[0]->i1,
+                            &r
+                          )
+                      )
+                      {
+                        lit->i1 = r;
+                        *pp = pp[0]->next; /* remove folded operand */
+                        continue;
+                      } /*if*/
+                  } /*if*/
+                pp = &pp[0]->next;
+              } /*for*/
+          } /*if*/
+      /* fold leading literal operands */
+        while
+          (
+                v->param->op == VM_VAL
+            &&
+                v->param->i1 >= 0
+            &&
+                v->param->next != NULL
+            &&
+                v->param->next->op == VM_VAL
+            &&
+                v->param->next->i1 >= 0
+            &&
+                foldop(v->op, v->param->i1, v->param->next->i1, &r)
+          )
+          {
+            v->param->i1 = r;
+            v->param->next = v->param->next->next;
+          } /*while*/
+      /* drop identity operands (not the first, except for commutative ops), and
+        look for absorbing ones */
+        nrops = 0;
+        for (lit = v->param; lit; lit = lit->next)
+            nrops++;
+        for (pp = &v->param; *pp;)
+          {
+            const bool isfirst = *pp == v->param;
+            if (nrops > 1 && pp[0]->op == VM_VAL && pp[0]->i1 >= 0 && (!isfirst || isassoc))
+              {
+                const int c = pp[0]->i1;
+                if
+                  (
+                        (c == 0 && (v->op == VM_ADD || v->op == VM_SUB || v->op == VM_OR || v->op == VM_XOR))
+                    ||
+                        (c == 1 && (v->op == VM_MUL || v->op == VM_DIV))
+                    ||
+                        (c == 65535 && v->op == VM_AND)
+                  )
+                  {
+                    *pp = pp[0]->next;
+                    nrops--;
+                    continue;
+                  } /*if*/
+                if ((c == 0 && (v->op == VM_MUL || v->op == VM_AND)) || (c == 65535 && v->op == VM_OR))
+                  {
+                    replaceexpr(vp, newval(c)); /* whole expression has this value */
+                    return;
+                  } /*if*/
+              } /*if*/
+            pp = &pp[0]->next;
+          } /*for*/
+        if (nrops == 1)
+          {
+          /* operator has disappeared */
+            replaceexpr(vp, v->param);
+            v = *vp;
+            if (v->op == VM_VAL)
+                return;
+          } /*if*/
+      } /*if*/
+    if (isplainexpr(v))
+      {
+      /* look for a register that already holds this value */
+        for (i = 0; i < es->nrregs; i++)
+            if (es->avail[i] && sameexpr(es->avail[i], v))
+              {
+                replaceexpr(vp, newval(i - 256));
+                break;
+              } /*if; for*/
+      } /*if*/
+  } /*optimizeexpr*/
+
+static int optimizebool(struct exprstate *es, struct vm_statement **vp)
+  /* optimizes the operands of the boolean expression *vp, which may be replaced.
+    Returns 1 or 0 if its value is now known to be true or false, -1 if unknown. */
+  {
+    struct vm_statement * const v = *vp;
+    struct vm_statement **pp;
+    int result;
+    switch (v->op)
+      {
+    case VM_EQ:
+    case VM_NE:
+    case VM_GTE:
+    case VM_GT:
+    case VM_LTE:
+    case VM_LT:
+      {
+        int a, b;
+        optimizeexpr(es, &v->param);
+        optimizeexpr(es, &v->param->next);
+        if (v->param->op != VM_VAL || v->param->next->op != VM_VAL)
+            return -1;
+        a = v->param->i1;
+        b = v->param->next->i1;
+        if (a < 0 || b < 0)
+            return
+                a != b ?
+                    -1
+                : /* same register on both sides */
+                    v->op == VM_EQ || v->op == VM_GTE || v->op == VM_LTE;
+        switch (v->op)
+          {
+        case VM_EQ:
+            return a == b;
+        case VM_NE:
+            return a != b;
+        case VM_GTE:
+            return a >= b;
+        case VM_GT:
+            return a > b;
+        case VM_LTE:
+            return a <= b;
+        default: /* VM_LT */
+            return a < b;
+          } /*switch*/
+      } /*case*/
+
+    case VM_LAND:
+    case VM_LOR:
+      {
+        const int decisive = v->op == VM_LOR; /* value that decides the outcome */
+        int nrops = 0;
+        result = !decisive; /* if all operands end up being removed */
+        for (pp = &v->param; *pp;)
+          {
+            const int r = optimizebool(es, pp);
+            if (r == decisive)
+                return decisive;
+            if (r >= 0)
+              {
+                *pp = pp[0]->next; /* operand makes no difference */
+                continue;
+              } /*if*/
+            result = -1;
+            nrops++;
+            pp = &pp[0]->next;
+          } /*for*/
+        if (nrops == 1)
+            replaceexpr(vp, v->param);
+      }
+    break;
+
+    case VM_NOT:
+        result = optimizebool(es, &v->param);
+        if (result >= 0)
+            result = !result;
+    break;
+
+    default:
+        result = -1;
+    break;
+      } /*switch*/
+    return result;
+  } /*optimizebool*/
+
+static bool containslabel(const struct vm_statement *cs)
+  /* does the statement sequence cs, or anything nested inside it, define a label. */
+  {
+    for (; cs; cs = cs->next)
+      {
+        if (cs->op == VM_LABEL)
+            return true;
+        if
+          (
+                cs->op == VM_IF
+            &&
+                (containslabel(cs->param->next->param) || containslabel(cs->param->next->next))
+          )
+            return true;
+      } /*for*/
+    return false;
+  } /*containslabel*/
+
+static bool optimizestatements(struct exprstate *es, struct vm_statement *cs)
+  /* does expression-level optimization on the statement sequence cs, given what
+    is known in es on entry. Statements that become unnecessary are turned into
+    VM_NOPs rather than being unlinked, so the same parse tree can safely be
+    compiled more than once. Returns true if any statements were removed, in
+    which case another pass may find more to do. */
+  {
+    bool removed = false;
+    while (cs)
+      {
+        switch (cs->op)
+          {
+        case VM_SET:
+            if (cs->i1 < es->nrregs)
+              {
+              /* assignment to a tracked GPRM */
+                const int reg = cs->i1;
+                optimizeexpr(es, &cs->param);
+                notereads(es, cs->param);
+                if
+                  (
+                        cs->param->op == VM_VAL
+                    &&
+                        (
+                            cs->param->i1 == reg - 256 /* assigning register to itself */
+                        ||
+                            (cs->param->i1 >= 0 && cs->param->i1 == es->value[reg])
+                              /* already known to have this value */
+                        )
+                  )
+                  {
+                    cs->op = VM_NOP;
+                    removed = true;
+                    break;
+                  } /*if*/
+                if (es->pending[reg])
+                  {
+                    es->pending[reg]->op = VM_NOP; /* previous value never used */
+                    removed = true;
+                  } /*if*/
+                forgetreg(es, reg);
+                if (cs->param->op == VM_VAL && cs->param->i1 >= 0)
+                    es->value[reg] = cs->param->i1;
+                else if
+                  (
+                        cs->param->op != VM_VAL
+                    &&
+                        isplainexpr(cs->param)
+                    &&
+                        !exprusesreg(cs->param, reg)
+                  )
+                    es->avail[reg] = cs->param;
+                es->pending[reg] = cs;
+              }
+            else
+              {
+              /* untracked GPRM (temporaries g13-g15 when these are reserved), counter-mode
+                GPRM or SPRM; the instructions for these can take a register operand
+                directly, so leave a lone one alone */
+                if (cs->param->op != VM_VAL)
+                    optimizeexpr(es, &cs->param);
+                notereads(es, cs->param);
+                if (cs->i1 >= 32 && cs->i1 < 32 + es->nrregs)
+                  {
+                    forgetreg(es, cs->i1 - 32);
+                    es->pending[cs->i1 - 32] = NULL;
+                  } /*if*/
+              } /*if*/
+        break;
+
+        case VM_IF:
+          {
+            struct vm_statement * const branches = cs->param->next;
+            const int cond = optimizebool(es, &cs->param);
+            int i;
+            if (cond >= 0)
+              {
+                if (!containslabel(cond ? branches->next : branches->param))
+                  {
+                  /* replace the if-statement with the branch taken */
+                    struct vm_statement * const taken = cond ? branches->param : branches->next;
+                    struct vm_statement * const follow = cs->next;
+                    struct vm_statement *last;
+                    if (taken)
+                      {
+                        *cs = *taken;
+                        for (last = cs; last->next; last = last->next)
+                            ;
+                        last->next = follow;
+                      }
+                    else
+                      {
+                        memset(cs, 0, sizeof(struct vm_statement));
+                        cs->op = VM_NOP;
+                        cs->next = follow;
+                      } /*if*/
+                    removed = true;
+                    continue; /* process the replacement statements in the same sequence */
+                  } /*if*/
+              /* can't get rid of the other branch, so replace the condition with one
+                that compilebool can do in one instruction without a temporary register */
+                  {
+                    struct vm_statement * const c = statement_new();
+                    c->op = cond ? VM_EQ : VM_NE;
+                    c->param = newval(-256);
+                    c->param->next = newval(-256); /* g0 == g0 or g0 != g0 */
+                    replaceexpr(&cs->param, c);
+                  }
+              } /*if*/
+          /* each branch starts with what is known now, but there is no
+            telling which register values will be needed afterwards */
+            for (i = 0; i < es->nrregs; i++)
+                es->pending[i] = NULL;
+              {
+                struct exprstate branchstate = *es;
+                removed = optimizestatements(&branchstate, branches->param) || removed;
+                branchstate = *es;
+                removed = optimizestatements(&branchstate, branches->next) || removed;
+              }
+            exprstate_reset(es);
+          }
+        break;
+
+        case VM_NOP:
+        break;
+
+        default:
+          /* label, goto, break, jump, call, link, exit */
+            exprstate_reset(es);
+        break;
+          } /*switch*/
+        cs = cs->next;
+      } /*while*/
+    return removed;
+  } /*optimizestatements*/
+
 unsigned char *vm_compile
   (
     const unsigned char *obuf, /* start of buffer for computing instruction numbers for branches */
@@ -1550,7 +2073,7 @@ unsigned char *vm_compile
     const struct workset *ws,
     const struct pgcgroup *curgroup,
     const struct pgc *curpgc,
-    const struct vm_statement *cs,
+    struct vm_statement *cs,
     vtypes ismenu
   )
   /* compiles the parse tree cs into actual VM instructions with optimization,
@@ -1558,8 +2081,12 @@ unsigned char *vm_compile
   {
     unsigned char *end;
     int i, j;
+    struct exprstate es;
     numlabels = 0;
     numgotos = 0;
+    do /* removing dead assignments can make earlier ones dead in turn */
+        exprstate_reset(&es);
+    while (optimizestatements(&es, cs));
     end = compilecs(obuf, buf, ws, curgroup, curpgc, cs, ismenu);
     if (!end) /* error */
         return end;
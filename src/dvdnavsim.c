@@ -0,0 +1,1534 @@
+/*
+    dvdnavsim mainline -- offline simulation of DVD-Video navigation commands
+*/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+    Loads the IFO files of an authored DVD-Video directory and executes the PGC
+    pre/post/cell and button commands in an emulated DVD VM, starting from the
+    first-play PGC. Every point at which playback of a cell would begin is a
+    "playback state"; from each one, the possible user and player events (pressing
+    each button, reaching the end of the cell) are tried in turn, each giving a
+    "hop" of VM instructions leading to another playback state. The exploration
+    continues until no new playback states turn up, and then a report is produced
+    of reachable and unreachable PGCs, register usage and the longest hops.
+
+    Registers are simulated concretely, so the exploration follows the actual
+    values the commands compute. The random-number instruction always returns 1,
+    the navigation timer is not simulated, and the player's menu/title keys are
+    not tried as events.
+*/
+
+#include "compat.h"
+
+#include <errno.h>
+#include <stdarg.h>
+
+#include "common.h"
+
+#define MAXVTS 99
+#define MAXTRAIL 12 /* max nr PGCs to remember as path of a hop */
+#define HOPLIMIT 100000 /* max nr instructions in one hop before assuming it loops */
+#define PGCLIMIT 10000 /* max nr PGCs entered in one hop before assuming it loops */
+
+enum /* navigation domains */
+  {
+    DOM_NONE = -1,
+    DOM_FP = 0, /* first-play PGC */
+    DOM_VMGM, /* VMG menus */
+    DOM_VTSM, /* titleset menus */
+    DOM_VTS, /* titleset titles */
+  };
+
+static const char * const domnames[] = {"FP", "VMGM", "VTSM", "VTS"};
+
+struct navcell /* info about a cell */
+  {
+    int stilltime; /* 255 => infinite */
+    int cmdnr; /* 1-based index into cell commands, 0 if none */
+    int nrbuttons;
+    const unsigned char *buttons; /* nrbuttons * 8 bytes of button commands */
+  };
+
+struct navpgc /* info about a PGC */
+  {
+    int entry; /* menu entry type, or title nr for entry PGC of a title, 0 if neither */
+    int nrprograms, nrcells;
+    int nextpgc, prevpgc, goup;
+    const unsigned char *progmap; /* first cell of each program */
+    struct navcell *cells;
+    int nrpre, nrpost, nrcellcmds;
+    const unsigned char *pre, *post, *cellcmds;
+    bool reached; /* whether any hop entered this PGC */
+  };
+
+struct navpgcgroup /* the menus of a domain (only the first language unit), or its titles */
+  {
+    int nrpgcs;
+    struct navpgc *pgcs;
+  };
+
+struct navvts /* info about a titleset */
+  {
+    struct navpgcgroup menus, titles;
+    int nrtitles;
+    int *nrchapters; /* array[nrtitles] */
+    unsigned int **ptts; /* array[nrtitles] of array[nrchapters] of pgcn << 16 | pgn */
+  };
+
+struct navtitle /* entry in VMG TT_SRPT */
+  {
+    int vts, ttn;
+  };
+
+struct vobfiles /* the files making up a VOBS */
+  {
+    int nrfiles;
+    char *names[10];
+    off_t sizes[10];
+  };
+
+struct navloc /* a location within the disc */
+  {
+    int domain, vts, pgcn, cell;
+  };
+
+struct navstate /* a point at which playback of a cell begins */
+  {
+    struct navloc loc;
+    struct navloc resume; /* where RSM will go, domain = DOM_NONE if nowhere */
+    uint16_t gprm[16], sprm[24];
+  };
+
+enum /* things that can start a hop */
+  {
+    ORIGIN_FP = 0, /* inserting the disc */
+    ORIGIN_BUTTON, /* user activated a button */
+    ORIGIN_CELL, /* end of cell, with or without a cell command */
+    ORIGIN_COUNT
+  };
+
+static const char * const originnames[] = {"first play", "button", "end of cell"};
+
+enum /* what to do next while executing a hop */
+  {
+    STEP_FALLOFF, /* command list finished without a transfer */
+    STEP_PRE, /* enter the PGC at the current location and run its pre commands */
+    STEP_POST, /* run the post commands of the current PGC */
+    STEP_PLAY, /* start playing the current cell */
+    STEP_STOP, /* playback stops */
+    STEP_ERROR, /* invalid command or target */
+  };
+
+struct navhop /* summary of one hop */
+  {
+    struct navloc from, to;
+    int origin, button;
+    int result; /* STEP_PLAY, STEP_STOP or STEP_ERROR */
+    int nrinstrs, nrpgcs;
+    struct navloc trail[MAXTRAIL];
+    int trailsize;
+    char errmsg[80];
+  };
+
+struct navvm /* execution state during a hop */
+  {
+    struct navstate st;
+    int startcell; /* where to start playing after the pre commands */
+    struct navhop hop;
+  };
+
+static const char *dvddir;
+static struct navpgc fpc;
+static struct navpgcgroup vmgm;
+static struct navvts vtsl[MAXVTS];
+static int nrvts;
+static struct navtitle *titles;
+static int nrtitles;
+
+static struct navstate *states; /* all playback states found so far */
+static int nrstates, maxstates = 100000, statesalloc;
+static int *statehash; /* open-addressed table of indexes into states, -1 for empty */
+static int statehashsize;
+
+static struct navhop *slowest; /* longest hops found, in decreasing order */
+static int nrslowest, maxslowest = 10;
+static int nrhops[ORIGIN_COUNT], maxhopinstrs[ORIGIN_COUNT];
+static long totalhopinstrs[ORIGIN_COUNT];
+static long gprmread[16], gprmwritten[16], sprmread[24], sprmwritten[24];
+static struct navhop *errhops;
+static int nrerrhops;
+static bool verbose = false;
+
+static unsigned int read4(const unsigned char *p)
+/* extracts a four-byte integer in big-endian format beginning at address p. */
+  {
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+  } /*read4*/
+
+static unsigned int read2(const unsigned char *p)
+/* extracts a two-byte integer in big-endian format beginning at address p. */
+  {
+    return (p[0] << 8) | p[1];
+  } /*read2*/
+
+/*
+    Loading of IFO and NAV-pack information
+*/
+
+static unsigned char *readfile(const char *fname, size_t *len)
+  /* reads the entire contents of the specified file into memory. Returns NULL
+    if the file does not exist. */
+  {
+    FILE * const h = fopen(fname, "rb");
+    unsigned char *buf;
+    long size;
+    if (!h)
+      {
+        if (errno == ENOENT)
+            return NULL;
+        fprintf(stderr, "ERR:  Error %d -- %s -- opening %s\n", errno, strerror(errno), fname);
+        exit(1);
+      } /*if*/
+    fseek(h, 0, SEEK_END);
+    size = ftell(h);
+    fseek(h, 0, SEEK_SET);
+    buf = malloc(size > 0 ? size : 1);
+    if (size > 0 && fread(buf, size, 1, h) != 1)
+      {
+        fprintf(stderr, "ERR:  Error reading %s\n", fname);
+        exit(1);
+      } /*if*/
+    fclose(h);
+    *len = size;
+    return buf;
+  } /*readfile*/
+
+static void openvobs(struct vobfiles *vf, int vts, bool menu)
+  /* collects the names and sizes of the VOB files making up the menu or title VOBS
+    for the specified titleset (0 for the VMG). */
+  {
+    int i;
+    vf->nrfiles = 0;
+    for (i = menu ? 0 : 1; i <= (menu ? 0 : 9); i++)
+      {
+        struct stat info;
+        char * const fname =
+            vts == 0 ?
+                sprintf_alloc("%s/VIDEO_TS.VOB", dvddir)
+            :
+                sprintf_alloc("%s/VTS_%02d_%d.VOB", dvddir, vts, i);
+        if (stat(fname, &info) != 0)
+          {
+            free(fname);
+            break;
+          } /*if*/
+        vf->names[vf->nrfiles] = fname;
+        vf->sizes[vf->nrfiles] = info.st_size;
+        vf->nrfiles++;
+      } /*for*/
+  } /*openvobs*/
+
+static void closevobs(struct vobfiles *vf)
+  {
+    int i;
+    for (i = 0; i < vf->nrfiles; i++)
+        free(vf->names[i]);
+    vf->nrfiles = 0;
+  } /*closevobs*/
+
+static bool readsector(const struct vobfiles *vf, unsigned int sector, unsigned char *buf)
+  /* reads the specified sector of the VOBS into buf. Returns false if it is not there. */
+  {
+    off_t pos = (off_t)sector * 2048;
+    int i;
+    for (i = 0; i < vf->nrfiles; i++)
+      {
+        if (pos < vf->sizes[i])
+          {
+            FILE * const h = fopen(vf->names[i], "rb");
+            bool ok;
+            if (!h)
+                return false;
+            ok = fseeko(h, pos, SEEK_SET) == 0 && fread(buf, 2048, 1, h) == 1;
+            fclose(h);
+            return ok;
+          } /*if*/
+        pos -= vf->sizes[i];
+      } /*for*/
+    return false;
+  } /*readsector*/
+
+static void getbuttons(struct navcell *cell, const struct vobfiles *vf, unsigned int sector)
+  /* extracts the button commands from the PCI packet of the NAV pack at the
+    start of the cell. */
+  {
+    unsigned char buf[2048];
+    unsigned char *cmds;
+    int i;
+    cell->nrbuttons = 0;
+    cell->buttons = NULL;
+    if
+      (
+            !readsector(vf, sector, buf)
+        ||
+            read4(buf + 0x26) != 0x100 + MPID_PRIVATE2
+        ||
+            buf[0x2c] != 0 /* not PCI */
+      )
+        return;
+    cell->nrbuttons = buf[0x9e];
+    if (cell->nrbuttons > 36)
+        cell->nrbuttons = 36;
+    cmds = malloc(cell->nrbuttons * 8 + 1);
+    for (i = 0; i < cell->nrbuttons; i++)
+        memcpy(cmds + i * 8, buf + 0xbb + i * 18 + 10, 8);
+          /* only look at the first button group */
+    cell->buttons = cmds;
+  } /*getbuttons*/
+
+static void checkrange(size_t offset, size_t len, size_t filelen, const char *what)
+  /* aborts if the specified structure doesn't fit in the file. */
+  {
+    if (offset > filelen || len > filelen - offset)
+      {
+        fprintf(stderr, "ERR:  %s lies outside IFO file\n", what);
+        exit(1);
+      } /*if*/
+  } /*checkrange*/
+
+static void parsepgc
+  (
+    const unsigned char *ifo,
+    size_t ifolen,
+    size_t offset, /* where the PGC starts in ifo */
+    struct navpgc *pgc,
+    const struct vobfiles *vf
+  )
+  /* decodes a PGC structure. */
+  {
+    const unsigned char *p;
+    unsigned int cmdoff, celloff;
+    int i;
+    checkrange(offset, 0xec, ifolen, "PGC");
+    p = ifo + offset;
+    pgc->nrprograms = p[2];
+    pgc->nrcells = p[3];
+    pgc->nextpgc = read2(p + 0x9c);
+    pgc->prevpgc = read2(p + 0x9e);
+    pgc->goup = read2(p + 0xa0);
+    pgc->nrpre = pgc->nrpost = pgc->nrcellcmds = 0;
+    pgc->pre = pgc->post = pgc->cellcmds = NULL;
+    pgc->reached = false;
+    cmdoff = read2(p + 0xe4);
+    if (cmdoff)
+      {
+        const unsigned char * const c = p + cmdoff;
+        checkrange(offset + cmdoff, 8, ifolen, "PGC command table");
+        pgc->nrpre = read2(c);
+        pgc->nrpost = read2(c + 2);
+        pgc->nrcellcmds = read2(c + 4);
+        checkrange
+          (
+            offset + cmdoff + 8,
+            (pgc->nrpre + pgc->nrpost + pgc->nrcellcmds) * 8,
+            ifolen,
+            "PGC commands"
+          );
+        pgc->pre = c + 8;
+        pgc->post = pgc->pre + pgc->nrpre * 8;
+        pgc->cellcmds = pgc->post + pgc->nrpost * 8;
+      } /*if*/
+    pgc->progmap = p + read2(p + 0xe6);
+    if (pgc->nrprograms)
+        checkrange(offset + read2(p + 0xe6), pgc->nrprograms, ifolen, "PGC program map");
+    celloff = read2(p + 0xe8);
+    if (pgc->nrcells)
+        checkrange(offset + celloff, pgc->nrcells * 24, ifolen, "PGC cell playback table");
+    pgc->cells = calloc(pgc->nrcells + 1, sizeof(struct navcell));
+    for (i = 0; i < pgc->nrcells; i++)
+      {
+        const unsigned char * const c = p + celloff + i * 24;
+        pgc->cells[i].stilltime = c[2];
+        pgc->cells[i].cmdnr = c[3];
+        if (vf)
+            getbuttons(&pgc->cells[i], vf, read4(c + 8));
+      } /*for*/
+  } /*parsepgc*/
+
+static void parsemenus
+  (
+    const unsigned char *ifo,
+    size_t ifolen,
+    unsigned int sector, /* where the PGCI_UT starts in ifo */
+    struct navpgcgroup *group,
+    const struct vobfiles *vf
+  )
+  /* decodes the first language unit of a VMGM_PGCI_UT or VTSM_PGCI_UT. */
+  {
+    const unsigned char *ut, *lu;
+    size_t luoffset;
+    int i;
+    group->nrpgcs = 0;
+    group->pgcs = NULL;
+    if (!sector)
+        return;
+    checkrange(sector * 2048, 16, ifolen, "PGCI_UT");
+    ut = ifo + sector * 2048;
+    if (read2(ut) == 0)
+        return;
+    luoffset = sector * 2048 + read4(ut + 12);
+    checkrange(luoffset, 8, ifolen, "menu language unit");
+    lu = ifo + luoffset;
+    group->nrpgcs = read2(lu);
+    checkrange(luoffset, 8 + group->nrpgcs * 8, ifolen, "menu language unit");
+    group->pgcs = calloc(group->nrpgcs + 1, sizeof(struct navpgc));
+    for (i = 0; i < group->nrpgcs; i++)
+      {
+        const unsigned char * const srp = lu + 8 + i * 8;
+        parsepgc(ifo, ifolen, luoffset + read4(srp + 4), &group->pgcs[i], vf);
+        group->pgcs[i].entry = srp[0] & 0x80 ? srp[0] & 15 : 0;
+      } /*for*/
+  } /*parsemenus*/
+
+static void parsetitles
+  (
+    const unsigned char *ifo,
+    size_t ifolen,
+    unsigned int sector, /* where the VTS_PGCIT starts in ifo */
+    struct navpgcgroup *group,
+    const struct vobfiles *vf
+  )
+  /* decodes a VTS_PGCIT. */
+  {
+    const unsigned char *pt;
+    int i;
+    checkrange(sector * 2048, 8, ifolen, "VTS_PGCIT");
+    pt = ifo + sector * 2048;
+    group->nrpgcs = read2(pt);
+    checkrange(sector * 2048, 8 + group->nrpgcs * 8, ifolen, "VTS_PGCIT");
+    group->pgcs = calloc(group->nrpgcs + 1, sizeof(struct navpgc));
+    for (i = 0; i < group->nrpgcs; i++)
+      {
+        const unsigned char * const srp = pt + 8 + i * 8;
+        parsepgc(ifo, ifolen, sector * 2048 + read4(srp + 4), &group->pgcs[i], vf);
+        group->pgcs[i].entry = srp[0] & 0x80 ? srp[0] & 127 : 0;
+      } /*for*/
+  } /*parsetitles*/
+
+static void parseptts(const unsigned char *ifo, size_t ifolen, unsigned int sector, struct navvts *vts)
+  /* decodes a VTS_PTT_SRPT. */
+  {
+    const unsigned char *pt;
+    unsigned int end;
+    int i, j;
+    checkrange(sector * 2048, 8, ifolen, "VTS_PTT_SRPT");
+    pt = ifo + sector * 2048;
+    vts->nrtitles = read2(pt);
+    end = read4(pt + 4) + 1;
+    checkrange(sector * 2048, end, ifolen, "VTS_PTT_SRPT");
+    vts->nrchapters = calloc(vts->nrtitles + 1, sizeof(int));
+    vts->ptts = calloc(vts->nrtitles + 1, sizeof(unsigned int *));
+    for (i = 0; i < vts->nrtitles; i++)
+      {
+        const unsigned int start = read4(pt + 8 + i * 4);
+        const unsigned int next = i + 1 < vts->nrtitles ? read4(pt + 8 + (i + 1) * 4) : end;
+        vts->nrchapters[i] = next > start ? (next - start) / 4 : 0;
+        vts->ptts[i] = calloc(vts->nrchapters[i] + 1, sizeof(unsigned int));
+        for (j = 0; j < vts->nrchapters[i]; j++)
+            vts->ptts[i][j] = read2(pt + start + j * 4) << 16 | read2(pt + start + j * 4 + 2);
+      } /*for*/
+  } /*parseptts*/
+
+static void loaddisc(void)
+  /* loads all the navigation information for the disc. */
+  {
+    unsigned char *ifo;
+    size_t ifolen;
+    char *fname;
+    struct vobfiles vf;
+    int i;
+
+    fname = sprintf_alloc("%s/VIDEO_TS.IFO", dvddir);
+    ifo = readfile(fname, &ifolen);
+    if (!ifo || ifolen < 2048 || memcmp(ifo, "DVDVIDEO-VMG", 12) != 0)
+      {
+        fprintf(stderr, "ERR:  %s is missing or not a valid VMG IFO\n", fname);
+        exit(1);
+      } /*if*/
+    free(fname);
+    nrvts = read2(ifo + 0x3e);
+    if (nrvts > MAXVTS)
+      {
+        fprintf(stderr, "ERR:  Too many titlesets (%d)\n", nrvts);
+        exit(1);
+      } /*if*/
+    if (read4(ifo + 0x84))
+        parsepgc(ifo, ifolen, read4(ifo + 0x84), &fpc, NULL);
+      /* else leave it empty, so playback stops immediately */
+    openvobs(&vf, 0, true);
+    parsemenus(ifo, ifolen, read4(ifo + 0xc8), &vmgm, &vf);
+    closevobs(&vf);
+      {
+        const unsigned int tt = read4(ifo + 0xc4) * 2048;
+        checkrange(tt, 8, ifolen, "TT_SRPT");
+        nrtitles = read2(ifo + tt);
+        checkrange(tt, 8 + nrtitles * 12, ifolen, "TT_SRPT");
+        titles = calloc(nrtitles + 1, sizeof(struct navtitle));
+        for (i = 0; i < nrtitles; i++)
+          {
+            titles[i].vts = ifo[tt + 8 + i * 12 + 6];
+            titles[i].ttn = ifo[tt + 8 + i * 12 + 7];
+          } /*for*/
+      }
+  /* note ifo is never freed, because PGC command pointers point into it */
+
+    for (i = 0; i < nrvts; i++)
+      {
+        struct navvts * const vts = &vtsl[i];
+        fname = sprintf_alloc("%s/VTS_%02d_0.IFO", dvddir, i + 1);
+        ifo = readfile(fname, &ifolen);
+        if (!ifo || ifolen < 2048 || memcmp(ifo, "DVDVIDEO-VTS", 12) != 0)
+          {
+            fprintf(stderr, "ERR:  %s is missing or not a valid VTS IFO\n", fname);
+            exit(1);
+          } /*if*/
+        free(fname);
+        parseptts(ifo, ifolen, read4(ifo + 0xc8), vts);
+        openvobs(&vf, i + 1, false);
+        parsetitles(ifo, ifolen, read4(ifo + 0xcc), &vts->titles, &vf);
+        closevobs(&vf);
+        openvobs(&vf, i + 1, true);
+        parsemenus(ifo, ifolen, read4(ifo + 0xd0), &vts->menus, &vf);
+        closevobs(&vf);
+      } /*for*/
+  } /*loaddisc*/
+
+/*
+    The VM
+*/
+
+static struct navpgc *getpgc(const struct navloc *loc)
+  /* returns the PGC at the specified location, or NULL if there is none. */
+  {
+    const struct navpgcgroup *group;
+    switch (loc->domain)
+      {
+    case DOM_FP:
+        return &fpc;
+    case DOM_VMGM:
+        group = &vmgm;
+    break;
+    case DOM_VTSM:
+    case DOM_VTS:
+        if (loc->vts < 1 || loc->vts > nrvts)
+            return NULL;
+        group = loc->domain == DOM_VTSM ? &vtsl[loc->vts - 1].menus : &vtsl[loc->vts - 1].titles;
+    break;
+    default:
+        return NULL;
+      } /*switch*/
+    if (loc->pgcn < 1 || loc->pgcn > group->nrpgcs)
+        return NULL;
+    return &group->pgcs[loc->pgcn - 1];
+  } /*getpgc*/
+
+static int findentry(const struct navpgcgroup *group, int entry)
+  /* returns the number of the PGC in group with the specified menu entry type or
+    title number, or 0 if not found. */
+  {
+    int i;
+    for (i = 0; i < group->nrpgcs; i++)
+        if (group->pgcs[i].entry == entry)
+            return i + 1;
+    return 0;
+  } /*findentry*/
+
+static int vmerror(struct navvm *vm, const char *fmt, ...)
+  /* records an error encountered during the hop. */
+  {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(vm->hop.errmsg, sizeof vm->hop.errmsg, fmt, args);
+    va_end(args);
+    return STEP_ERROR;
+  } /*vmerror*/
+
+static unsigned int getreg(struct navvm *vm, int reg)
+  /* returns the value of a GPRM (0-15) or SPRM (128-151). */
+  {
+    if (reg & 0x80)
+      {
+        reg &= 0x1f;
+        if (reg >= 24)
+            return 0;
+        sprmread[reg]++;
+        return vm->st.sprm[reg];
+      }
+    else
+      {
+        reg &= 15;
+        gprmread[reg]++;
+        return vm->st.gprm[reg];
+      } /*if*/
+  } /*getreg*/
+
+static void setgprm(struct navvm *vm, int reg, unsigned int val)
+  {
+    reg &= 15;
+    gprmwritten[reg]++;
+    vm->st.gprm[reg] = val;
+  } /*setgprm*/
+
+static void setsprm(struct navvm *vm, int reg, unsigned int val)
+  {
+    sprmwritten[reg]++;
+    vm->st.sprm[reg] = val;
+  } /*setsprm*/
+
+static bool evalcompare(struct navvm *vm, int op, int reg1, bool immed, unsigned int val2)
+  /* evaluates a comparison; val2 is a register number if immed is false. */
+  {
+    const unsigned int a = getreg(vm, reg1);
+    const unsigned int b = immed ? val2 : getreg(vm, val2);
+    switch (op)
+      {
+    case 1:
+        return (a & b) != 0;
+    case 2:
+        return a == b;
+    case 3:
+        return a != b;
+    case 4:
+        return a >= b;
+    case 5:
+        return a > b;
+    case 6:
+        return a <= b;
+    case 7:
+        return a < b;
+    default:
+        return true; /* unconditional */
+      } /*switch*/
+  } /*evalcompare*/
+
+static unsigned int calcset(int op, unsigned int a, unsigned int b)
+  /* computes the result of a set operation with 16-bit saturating arithmetic. */
+  {
+    unsigned int r;
+    switch (op)
+      {
+    case 1: /* mov */
+        r = b;
+    break;
+    case 3: /* add */
+        r = a + b > 65535 ? 65535 : a + b;
+    break;
+    case 4: /* sub */
+        r = a > b ? a - b : 0;
+    break;
+    case 5: /* mul */
+        r = a * b > 65535 ? 65535 : a * b;
+    break;
+    case 6: /* div */
+        r = b ? a / b : 65535;
+    break;
+    case 7: /* mod */
+        r = b ? a % b : a;
+    break;
+    case 8: /* random */
+        r = 1; /* keep simulation deterministic */
+    break;
+    case 9: /* and */
+        r = a & b;
+    break;
+    case 10: /* or */
+        r = a | b;
+    break;
+    case 11: /* xor */
+        r = a ^ b;
+    break;
+    default:
+        r = a;
+    break;
+      } /*switch*/
+    return r;
+  } /*calcset*/
+
+static void doset(struct navvm *vm, int op, int dstreg, bool immed, unsigned int src)
+  /* performs a GPRM set operation; src is a register number if immed is false. */
+  {
+    if (op == 0)
+        return;
+    if (op == 2) /* swap */
+      {
+        const unsigned int a = getreg(vm, dstreg);
+        const unsigned int b = immed ? src : getreg(vm, src);
+        setgprm(vm, dstreg, b);
+        if (!immed && !(src & 0x80))
+            setgprm(vm, src, a);
+      }
+    else
+        setgprm
+          (
+            vm,
+            dstreg,
+            calcset(op, op != 1 && op != 8 ? getreg(vm, dstreg) : 0, immed ? src : getreg(vm, src))
+          );
+  } /*doset*/
+
+static void setbutton(struct navvm *vm, int button)
+  /* sets the highlighted button if nonzero. */
+  {
+    if (button)
+        setsprm(vm, 8, button << 10);
+  } /*setbutton*/
+
+static int gotoprogram(struct navvm *vm, int pgn)
+  /* transfers to the start of the specified program of the current PGC. */
+  {
+    const struct navpgc * const pgc = getpgc(&vm->st.loc);
+    if (pgn < 1 || pgn > pgc->nrprograms)
+        return vmerror(vm, "no program %d", pgn);
+    vm->st.loc.cell = pgc->progmap[pgn - 1];
+    return STEP_PLAY;
+  } /*gotoprogram*/
+
+static int curprogram(const struct navpgc *pgc, int cell)
+  /* returns the number of the program containing the specified cell. */
+  {
+    int i;
+    for (i = pgc->nrprograms; i > 1; i--)
+        if (pgc->progmap[i - 1] <= cell)
+            break;
+    return i;
+  } /*curprogram*/
+
+static int gotopgc(struct navvm *vm, int pgcn)
+  /* transfers to the specified PGC in the current domain. */
+  {
+    if (pgcn == 0)
+        return STEP_STOP;
+    vm->st.loc.pgcn = pgcn;
+    vm->startcell = 1;
+    return STEP_PRE;
+  } /*gotopgc*/
+
+static int gotochapter(struct navvm *vm, int vts, int ttn, int ptt)
+  /* transfers to the specified chapter (0 for start) of the specified title
+    in the specified titleset. */
+  {
+    const struct navvts *v;
+    int i, pgcn;
+    if (vts < 1 || vts > nrvts)
+        return vmerror(vm, "no titleset %d", vts);
+    v = &vtsl[vts - 1];
+    if (ttn < 1 || ttn > v->nrtitles)
+        return vmerror(vm, "no title %d in titleset %d", ttn, vts);
+    if (ptt > v->nrchapters[ttn - 1])
+        return vmerror(vm, "no chapter %d in titleset %d title %d", ptt, vts, ttn);
+    pgcn = ptt ? v->ptts[ttn - 1][ptt - 1] >> 16 : findentry(&v->titles, ttn);
+    if (pgcn < 1 || pgcn > v->titles.nrpgcs)
+        return vmerror(vm, "no PGC for titleset %d title %d", vts, ttn);
+    vm->st.loc.domain = DOM_VTS;
+    vm->st.loc.vts = vts;
+    vm->st.loc.pgcn = pgcn;
+    vm->startcell = 1;
+    if (ptt)
+      {
+        const struct navpgc * const pgc = &v->titles.pgcs[pgcn - 1];
+        const int pgn = v->ptts[ttn - 1][ptt - 1] & 0xffff;
+        if (pgn >= 1 && pgn <= pgc->nrprograms)
+            vm->startcell = pgc->progmap[pgn - 1];
+      } /*if*/
+    for (i = 0; i < nrtitles; i++)
+        if (titles[i].vts == vts && titles[i].ttn == ttn)
+          {
+            setsprm(vm, 4, i + 1);
+            break;
+          } /*if; for*/
+    setsprm(vm, 5, ttn);
+    setsprm(vm, 6, pgcn);
+    setsprm(vm, 7, ptt ? ptt : 1);
+    return STEP_PRE;
+  } /*gotochapter*/
+
+static int gotomenu(struct navvm *vm, int domain, int vts, int entry, int pgcn)
+  /* transfers to the specified menu entry or, if entry is 0, menu PGC number. */
+  {
+    const struct navpgcgroup *group;
+    if (domain == DOM_VTSM)
+      {
+        if (vts < 1 || vts > nrvts)
+            return vmerror(vm, "no titleset %d", vts);
+        group = &vtsl[vts - 1].menus;
+      }
+    else
+        group = &vmgm;
+    if (entry)
+      {
+        pgcn = findentry(group, entry);
+        if (!pgcn)
+            return
+                vmerror(vm, "no menu entry %d in %s%s", entry, domnames[domain], domain == DOM_VTSM ? " (titleset)" : "");
+      } /*if*/
+    if (pgcn < 1 || pgcn > group->nrpgcs)
+        return vmerror(vm, "no PGC %d in %s", pgcn, domnames[domain]);
+    vm->st.loc.domain = domain;
+    vm->st.loc.vts = domain == DOM_VTSM ? vts : 0;
+    vm->st.loc.pgcn = pgcn;
+    vm->startcell = 1;
+    return STEP_PRE;
+  } /*gotomenu*/
+
+static int dolinksub(struct navvm *vm, int linkop, int button)
+  /* performs a LinkSIns instruction. */
+  {
+    const struct navpgc * const pgc = getpgc(&vm->st.loc);
+    struct navloc * const loc = &vm->st.loc;
+    setbutton(vm, button);
+    switch (linkop)
+      {
+    case 0: /* LinkNoLink */
+        return STEP_FALLOFF;
+    case 1: /* LinkTopC */
+        return STEP_PLAY;
+    case 2: /* LinkNextC */
+        if (loc->cell >= pgc->nrcells)
+            return STEP_POST;
+        loc->cell++;
+        return STEP_PLAY;
+    case 3: /* LinkPrevC */
+        if (loc->cell > 1)
+            loc->cell--;
+        return STEP_PLAY;
+    case 5: /* LinkTopPG */
+        return gotoprogram(vm, curprogram(pgc, loc->cell));
+    case 6: /* LinkNextPG */
+        if (curprogram(pgc, loc->cell) >= pgc->nrprograms)
+            return STEP_POST;
+        return gotoprogram(vm, curprogram(pgc, loc->cell) + 1);
+    case 7: /* LinkPrevPG */
+        return gotoprogram(vm, curprogram(pgc, loc->cell) > 1 ? curprogram(pgc, loc->cell) - 1 : 1);
+    case 9: /* LinkTopPGC */
+        vm->startcell = 1;
+        return STEP_PRE;
+    case 10: /* LinkNextPGC */
+        return gotopgc(vm, pgc->nextpgc);
+    case 11: /* LinkPrevPGC */
+        return gotopgc(vm, pgc->prevpgc);
+    case 12: /* LinkGoUpPGC */
+        return gotopgc(vm, pgc->goup);
+    case 13: /* LinkTailPGC */
+        return STEP_POST;
+    case 16: /* RSM */
+        if (vm->st.resume.domain == DOM_NONE)
+            return vmerror(vm, "resume with nothing to resume");
+        *loc = vm->st.resume;
+        vm->st.resume.domain = DOM_NONE;
+        return STEP_PLAY;
+    default:
+        return vmerror(vm, "unknown link op %d", linkop);
+      } /*switch*/
+  } /*dolinksub*/
+
+static int dolink(struct navvm *vm, const unsigned char *cmd)
+  /* performs the link part of a type 1, 2 or 3 instruction. */
+  {
+    const struct navpgc * const pgc = getpgc(&vm->st.loc);
+    switch (cmd[1] & 15)
+      {
+    case 0:
+        return STEP_FALLOFF;
+    case 1: /* LinkSIns */
+        return dolinksub(vm, cmd[7] & 31, cmd[6] >> 2);
+    case 4: /* LinkPGCN */
+        return gotopgc(vm, read2(cmd + 6) & 0x7fff);
+    case 5: /* LinkPTTN */
+        setbutton(vm, cmd[6] >> 2);
+        if (vm->st.loc.domain != DOM_VTS)
+            return vmerror(vm, "link to chapter outside title domain");
+          {
+            const int ptt = read2(cmd + 6) & 0x3ff;
+            const int prevpgcn = vm->st.loc.pgcn;
+            const int step = gotochapter(vm, vm->st.loc.vts, vm->st.sprm[5], ptt);
+            if (step == STEP_PRE && vm->st.loc.pgcn == prevpgcn)
+              {
+                vm->st.loc.cell = vm->startcell;
+                return STEP_PLAY; /* same PGC, no pre commands */
+              } /*if*/
+            return step;
+          }
+    case 6: /* LinkPGN */
+        setbutton(vm, cmd[6] >> 2);
+        return gotoprogram(vm, cmd[7] & 127);
+    case 7: /* LinkCN */
+        setbutton(vm, cmd[6] >> 2);
+        if (cmd[7] < 1 || cmd[7] > pgc->nrcells)
+            return vmerror(vm, "no cell %d", cmd[7]);
+        vm->st.loc.cell = cmd[7];
+        return STEP_PLAY;
+    default:
+        return vmerror(vm, "unknown link instruction %d", cmd[1] & 15);
+      } /*switch*/
+  } /*dolink*/
+
+static int dojump(struct navvm *vm, const unsigned char *cmd)
+  /* performs a jump/call instruction. */
+  {
+    const int op = cmd[1] & 15;
+    const int kind = cmd[5] >> 6;
+    const int entry = cmd[5] & 15;
+    switch (op)
+      {
+    case 1: /* Exit */
+        return STEP_STOP;
+    case 2: /* JumpTT */
+      {
+        const int tt = cmd[5] & 127;
+        if (tt < 1 || tt > nrtitles)
+            return vmerror(vm, "no title %d", tt);
+        return gotochapter(vm, titles[tt - 1].vts, titles[tt - 1].ttn, 0);
+      }
+    case 3: /* JumpVTS_TT */
+    case 5: /* JumpVTS_PTT */
+        if (vm->st.loc.domain != DOM_VTS && vm->st.loc.domain != DOM_VTSM)
+            return vmerror(vm, "jump to titleset title outside titleset");
+        return
+            gotochapter(vm, vm->st.loc.vts, cmd[5] & 127, op == 5 ? read2(cmd + 2) & 0x3ff : 0);
+    case 6: /* JumpSS */
+    case 8: /* CallSS */
+        if (op == 8)
+          {
+            if (vm->st.loc.domain != DOM_VTS)
+                return vmerror(vm, "call outside title domain");
+            vm->st.resume = vm->st.loc;
+            if (cmd[4])
+                vm->st.resume.cell = cmd[4];
+          } /*if*/
+        switch (kind)
+          {
+        case 0:
+            vm->st.loc.domain = DOM_FP;
+            vm->st.loc.vts = 0;
+            vm->st.loc.pgcn = 1;
+            vm->startcell = 1;
+            return STEP_PRE;
+        case 1:
+            return gotomenu(vm, DOM_VMGM, 0, entry, 0);
+        case 2:
+            if (op == 8)
+                return gotomenu(vm, DOM_VTSM, vm->st.loc.vts, entry, 0);
+            if (cmd[3] > 1)
+                setsprm(vm, 5, cmd[3]);
+            return gotomenu(vm, DOM_VTSM, cmd[4], entry, 0);
+        default:
+            return gotomenu(vm, DOM_VMGM, 0, 0, read2(cmd + 2) & 0x7fff);
+          } /*switch*/
+    default:
+        return vmerror(vm, "unknown jump/call instruction %d", op);
+      } /*switch*/
+  } /*dojump*/
+
+static int dosystemset(struct navvm *vm, const unsigned char *cmd)
+  /* performs the set part of a type 2 instruction. */
+  {
+    const bool immed = (cmd[0] & 0x10) != 0;
+    int i;
+    switch (cmd[0] & 15)
+      {
+    case 1: /* SetSTN */
+        for (i = 1; i <= 3; i++)
+            if (cmd[2 + i] & 0x80)
+                setsprm(vm, i, immed ? cmd[2 + i] & 0x7f : getreg(vm, cmd[2 + i] & 15));
+    break;
+    case 2: /* SetNVTMR */
+        setsprm(vm, 9, immed ? read2(cmd + 2) : getreg(vm, cmd[3]));
+        setsprm(vm, 10, cmd[5]);
+    break;
+    case 3: /* SetGPRMMD */
+        setgprm(vm, cmd[5] & 15, immed ? read2(cmd + 2) : getreg(vm, cmd[3]));
+    break;
+    case 6: /* SetHL_BTNN */
+        setsprm(vm, 8, immed ? read2(cmd + 4) : getreg(vm, cmd[5] & 15));
+    break;
+    default:
+        return vmerror(vm, "unknown system set instruction %d", cmd[0] & 15);
+      } /*switch*/
+    return STEP_FALLOFF;
+  } /*dosystemset*/
+
+static int execcmds(struct navvm *vm, const unsigned char *cmds, int nrcmds)
+  /* executes the specified command list until it finishes or transfers elsewhere. */
+  {
+    int line = 1, step = STEP_FALLOFF;
+    while (line >= 1 && line <= nrcmds)
+      {
+        const unsigned char * const cmd = cmds + (line - 1) * 8;
+        const int cmpop = cmd[1] >> 4 & 7;
+        bool cond;
+        line++;
+        if (++vm->hop.nrinstrs > HOPLIMIT)
+            return vmerror(vm, "more than %d instructions, probably loops", HOPLIMIT);
+        switch (cmd[0] >> 5)
+          {
+        case 0: /* special */
+            if (!evalcompare(vm, cmpop, cmd[3], cmd[1] & 0x80, cmd[1] & 0x80 ? read2(cmd + 4) : cmd[5]))
+                break;
+            switch (cmd[1] & 15)
+              {
+            case 0: /* Nop */
+            case 3: /* SetTmpPML, treated as never changing parental level */
+            break;
+            case 1: /* Goto */
+                line = cmd[7];
+            break;
+            case 2: /* Break */
+                return STEP_FALLOFF;
+            default:
+                return vmerror(vm, "unknown special instruction %d", cmd[1] & 15);
+              } /*switch*/
+        break;
+        case 1: /* jump/call or link */
+            if (cmd[0] & 0x10)
+              {
+                if (evalcompare(vm, cmpop, cmd[6], false, cmd[7]))
+                    step = dojump(vm, cmd);
+              }
+            else
+              {
+                if (evalcompare(vm, cmpop, cmd[3], cmd[1] & 0x80, cmd[1] & 0x80 ? read2(cmd + 4) : cmd[5]))
+                    step = dolink(vm, cmd);
+              } /*if*/
+        break;
+        case 2: /* set system parameters, then link */
+            if (evalcompare(vm, cmpop, cmd[6], false, cmd[7]))
+              {
+                step = dosystemset(vm, cmd);
+                if (step == STEP_FALLOFF && cmpop == 0)
+                    step = dolink(vm, cmd);
+                      /* link operands overlap comparison operands, so can't have both */
+              } /*if*/
+        break;
+        case 3: /* set GPRM, then link */
+            if (evalcompare(vm, cmpop, cmd[2], cmd[1] & 0x80, cmd[1] & 0x80 ? read2(cmd + 6) : cmd[7]))
+              {
+                doset(vm, cmd[0] & 15, cmd[3], cmd[0] & 0x10, cmd[0] & 0x10 ? read2(cmd + 4) : cmd[5]);
+                if (cmpop == 0)
+                    step = dolink(vm, cmd); /* as above */
+              } /*if*/
+        break;
+        case 4: /* set, then compare -> LinkSIns */
+            doset(vm, cmd[0] & 15, cmd[1] & 15, cmd[0] & 0x10, cmd[0] & 0x10 ? read2(cmd + 2) : cmd[3]);
+            if (evalcompare(vm, cmpop, cmd[1] & 15, cmd[1] & 0x80, cmd[1] & 0x80 ? read2(cmd + 4) : cmd[5]))
+                step = dolinksub(vm, cmd[7] & 31, cmd[6] >> 2);
+        break;
+        case 5: /* compare -> set and LinkSIns */
+        case 6: /* compare -> set, then LinkSIns */
+          {
+            const bool cond5 = (cmd[0] & 0x10) != 0;
+            cond =
+                cond5 ?
+                    evalcompare(vm, cmpop, cmd[4], false, cmd[5])
+                :
+                    evalcompare(vm, cmpop, cmd[3], cmd[1] & 0x80, cmd[1] & 0x80 ? read2(cmd + 4) : cmd[5]);
+            if (cond)
+                doset(vm, cmd[0] & 15, cmd[1] & 15, cond5, cond5 ? read2(cmd + 2) : cmd[2]);
+            if (cond || cmd[0] >> 5 == 6)
+                step = dolinksub(vm, cmd[7] & 31, cmd[6] >> 2);
+          }
+        break;
+        default:
+            return vmerror(vm, "unknown instruction type %d", cmd[0] >> 5);
+          } /*switch*/
+        if (step != STEP_FALLOFF)
+            break;
+      } /*while*/
+    return step;
+  } /*execcmds*/
+
+/*
+    Exploration
+*/
+
+static unsigned int hashstate(const struct navstate *st)
+  /* FNV-1a hash of a playback state. */
+  {
+    const unsigned char *p = (const unsigned char *)st;
+    unsigned int h = 2166136261u;
+    size_t i;
+    for (i = 0; i < sizeof(struct navstate); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+  } /*hashstate*/
+
+static bool addstate(const struct navstate *st)
+  /* adds a new playback state to be explored, returning false if it was
+    already seen or there is no more room. */
+  {
+    unsigned int i;
+    if (nrstates * 2 >= statehashsize)
+      {
+      /* grow hash table and rehash */
+        int j;
+        statehashsize = statehashsize ? statehashsize * 2 : 1024;
+        free(statehash);
+        statehash = malloc(statehashsize * sizeof(int));
+        for (j = 0; j < statehashsize; j++)
+            statehash[j] = -1;
+        for (j = 0; j < nrstates; j++)
+          {
+            i = hashstate(&states[j]) & (statehashsize - 1);
+            while (statehash[i] >= 0)
+                i = (i + 1) & (statehashsize - 1);
+            statehash[i] = j;
+          } /*for*/
+      } /*if*/
+    i = hashstate(st) & (statehashsize - 1);
+    while (statehash[i] >= 0)
+      {
+        if (memcmp(&states[statehash[i]], st, sizeof(struct navstate)) == 0)
+            return false;
+        i = (i + 1) & (statehashsize - 1);
+      } /*while*/
+    if (nrstates == maxstates)
+        return false;
+    if (nrstates == statesalloc)
+      {
+        statesalloc = statesalloc ? statesalloc * 2 : 256;
+        states = realloc(states, statesalloc * sizeof(struct navstate));
+      } /*if*/
+    states[nrstates] = *st;
+    statehash[i] = nrstates;
+    nrstates++;
+    return true;
+  } /*addstate*/
+
+static void formatloc(char *buf, size_t buflen, const struct navloc *loc, bool withcell)
+  /* formats a location for display. */
+  {
+    switch (loc->domain)
+      {
+    case DOM_FP:
+        snprintf(buf, buflen, "FP");
+    break;
+    case DOM_VMGM:
+        snprintf(buf, buflen, "VMGM pgc %d", loc->pgcn);
+    break;
+    default:
+        snprintf(buf, buflen, "%s %d pgc %d", domnames[loc->domain], loc->vts, loc->pgcn);
+    break;
+      } /*switch*/
+    if (withcell && loc->domain != DOM_FP)
+        snprintf(buf + strlen(buf), buflen - strlen(buf), " cell %d", loc->cell);
+  } /*formatloc*/
+
+static void printhop(FILE *out, const struct navhop *hop)
+  /* prints a description of a hop. */
+  {
+    char from[40], to[40];
+    int i;
+    if (hop->origin == ORIGIN_FP)
+        strcpy(from, "disc start");
+    else
+        formatloc(from, sizeof from, &hop->from, true);
+    fprintf(out, "%s", from);
+    if (hop->origin == ORIGIN_BUTTON)
+        fprintf(out, " button %d", hop->button);
+    else if (hop->origin == ORIGIN_CELL)
+        fprintf(out, " end");
+    switch (hop->result)
+      {
+    case STEP_PLAY:
+        formatloc(to, sizeof to, &hop->to, true);
+        fprintf(out, " -> %s", to);
+    break;
+    case STEP_STOP:
+        fprintf(out, " -> stop");
+    break;
+    default:
+        fprintf(out, " -> ERROR: %s", hop->errmsg);
+    break;
+      } /*switch*/
+    fprintf(out, ": %d instructions, %d PGCs entered\n", hop->nrinstrs, hop->nrpgcs);
+    if (hop->trailsize > 1)
+      {
+        fprintf(out, "      via");
+        for (i = 0; i < hop->trailsize; i++)
+          {
+            formatloc(to, sizeof to, &hop->trail[i], false);
+            fprintf(out, "%s %s", i ? " ->" : "", to);
+          } /*for*/
+        if (hop->nrpgcs > hop->trailsize)
+            fprintf(out, " -> ...");
+        fprintf(out, "\n");
+      } /*if*/
+  } /*printhop*/
+
+static bool samehop(const struct navhop *a, const struct navhop *b)
+  /* do a and b go the same way, albeit with possibly different register contents. */
+  {
+    return
+            a->origin == b->origin
+        &&
+            a->button == b->button
+        &&
+            a->result == b->result
+        &&
+            memcmp(&a->from, &b->from, sizeof(struct navloc)) == 0
+        &&
+            memcmp(&a->to, &b->to, sizeof(struct navloc)) == 0;
+  } /*samehop*/
+
+static void recordhop(const struct navhop *hop)
+  /* updates the statistics with a completed hop. */
+  {
+    int i, j;
+    nrhops[hop->origin]++;
+    totalhopinstrs[hop->origin] += hop->nrinstrs;
+    if (hop->nrinstrs > maxhopinstrs[hop->origin])
+        maxhopinstrs[hop->origin] = hop->nrinstrs;
+    if (verbose)
+      {
+        fprintf(stdout, "  ");
+        printhop(stdout, hop);
+      } /*if*/
+    if (hop->result == STEP_ERROR)
+      {
+        for (i = 0; i < nrerrhops; i++)
+            if (samehop(&errhops[i], hop))
+                break;
+        if (i == nrerrhops)
+          {
+            errhops = realloc(errhops, (nrerrhops + 1) * sizeof(struct navhop));
+            errhops[nrerrhops++] = *hop;
+          } /*if*/
+      } /*if*/
+  /* keep the slowest distinct hops in order of decreasing instruction count */
+    for (i = 0; i < nrslowest; i++)
+        if (samehop(&slowest[i], hop))
+            break;
+    if (i < nrslowest)
+      {
+        if (slowest[i].nrinstrs >= hop->nrinstrs)
+            return;
+        for (j = i; j < nrslowest - 1; j++)
+            slowest[j] = slowest[j + 1];
+        nrslowest--;
+      } /*if*/
+    for (i = nrslowest; i > 0 && slowest[i - 1].nrinstrs < hop->nrinstrs; i--)
+        ;
+    if (i == maxslowest)
+        return;
+    if (nrslowest < maxslowest)
+        nrslowest++;
+    for (j = nrslowest - 1; j > i; j--)
+        slowest[j] = slowest[j - 1];
+    slowest[i] = *hop;
+  } /*recordhop*/
+
+static void enterpgc(struct navvm *vm, struct navpgc *pgc)
+  /* notes that the VM has entered a PGC. */
+  {
+    pgc->reached = true;
+    if (vm->hop.trailsize < MAXTRAIL)
+        vm->hop.trail[vm->hop.trailsize++] = vm->st.loc;
+    vm->hop.nrpgcs++;
+    if (vm->st.loc.domain == DOM_VTS)
+        setsprm(vm, 6, vm->st.loc.pgcn);
+  } /*enterpgc*/
+
+static void runhop(const struct navstate *from, int origin, int button)
+  /* executes one hop from the specified playback state, adding the resulting
+    playback state, if any, to be explored later. */
+  {
+    struct navvm vm;
+    struct navpgc *pgc;
+    int step;
+    memset(&vm, 0, sizeof vm);
+    vm.st = *from;
+    vm.startcell = 1;
+    vm.hop.from = from->loc;
+    vm.hop.origin = origin;
+    vm.hop.button = button;
+    pgc = getpgc(&vm.st.loc);
+    switch (origin)
+      {
+    case ORIGIN_FP:
+        step = STEP_PRE;
+    break;
+    case ORIGIN_BUTTON:
+        setsprm(&vm, 8, button << 10);
+        step = execcmds(&vm, pgc->cells[vm.st.loc.cell - 1].buttons + (button - 1) * 8, 1);
+        if (step == STEP_FALLOFF)
+            step = STEP_PLAY; /* stay where I am */
+    break;
+    default: /* ORIGIN_CELL */
+      {
+        const int cmdnr = pgc->cells[vm.st.loc.cell - 1].cmdnr;
+        step = STEP_FALLOFF;
+        if (cmdnr >= 1 && cmdnr <= pgc->nrcellcmds)
+            step = execcmds(&vm, pgc->cellcmds + (cmdnr - 1) * 8, 1);
+        if (step == STEP_FALLOFF)
+          {
+            if (vm.st.loc.cell < pgc->nrcells)
+              {
+                vm.st.loc.cell++;
+                step = STEP_PLAY;
+              }
+            else
+                step = STEP_POST;
+          } /*if*/
+      }
+    break;
+      } /*switch*/
+    for (;;)
+      {
+        if (step == STEP_PRE || step == STEP_POST || step == STEP_PLAY)
+          {
+            pgc = getpgc(&vm.st.loc);
+            if (!pgc)
+              {
+                char where[40];
+                formatloc(where, sizeof where, &vm.st.loc, false);
+                step = vmerror(&vm, "nonexistent %s", where);
+              } /*if*/
+          } /*if*/
+        if (step == STEP_PRE)
+          {
+            enterpgc(&vm, pgc);
+            step = execcmds(&vm, pgc->pre, pgc->nrpre);
+            if (step == STEP_FALLOFF)
+              {
+                if (pgc->nrcells)
+                  {
+                    vm.st.loc.cell = vm.startcell;
+                    step = STEP_PLAY;
+                  }
+                else
+                    step = STEP_POST;
+              } /*if*/
+          }
+        else if (step == STEP_POST)
+          {
+            step = execcmds(&vm, pgc->post, pgc->nrpost);
+            if (step == STEP_FALLOFF)
+                step = gotopgc(&vm, pgc->nextpgc);
+          }
+        else if (step == STEP_PLAY)
+          {
+            if (vm.st.loc.cell < 1 || vm.st.loc.cell > pgc->nrcells)
+                step = vmerror(&vm, "no cell %d", vm.st.loc.cell);
+            else
+                break;
+          }
+        else
+            break;
+        if (vm.hop.nrinstrs > HOPLIMIT)
+          {
+            step = vmerror(&vm, "more than %d instructions, probably loops", HOPLIMIT);
+            break;
+          } /*if*/
+        if (vm.hop.nrpgcs > PGCLIMIT)
+          {
+          /* PGCs with no commands chained together can loop without executing any */
+            step = vmerror(&vm, "more than %d PGCs entered, probably loops", PGCLIMIT);
+            break;
+          } /*if*/
+      } /*for*/
+    vm.hop.result = step;
+    vm.hop.to = vm.st.loc;
+    recordhop(&vm.hop);
+    if (step == STEP_PLAY)
+        addstate(&vm.st);
+  } /*runhop*/
+
+static void explore(void)
+  /* explores all playback states reachable from first play. */
+  {
+    struct navstate st;
+    int i;
+    memset(&st, 0, sizeof st);
+    st.loc.domain = DOM_FP;
+    st.loc.pgcn = 1;
+    st.resume.domain = DOM_NONE;
+    st.sprm[2] = 62; /* no subpicture */
+    st.sprm[3] = 1; /* angle */
+    st.sprm[4] = st.sprm[5] = st.sprm[6] = st.sprm[7] = 1;
+    st.sprm[8] = 1 << 10; /* button 1 */
+    st.sprm[13] = 15; /* parental level */
+    st.sprm[20] = 1; /* region */
+    runhop(&st, ORIGIN_FP, 0);
+    for (i = 0; i < nrstates; i++)
+      {
+        const struct navstate thisstate = states[i]; /* states may be reallocated */
+        const struct navpgc * const pgc = getpgc(&thisstate.loc);
+        const struct navcell * const cell = &pgc->cells[thisstate.loc.cell - 1];
+        int b;
+        for (b = 1; b <= cell->nrbuttons; b++)
+            runhop(&thisstate, ORIGIN_BUTTON, b);
+        if (cell->stilltime != 255) /* infinite still only ends by button activation */
+            runhop(&thisstate, ORIGIN_CELL, 0);
+      } /*for*/
+  } /*explore*/
+
+/*
+    Report
+*/
+
+static void reportunreached(const struct navpgcgroup *group, const char *what, int vts)
+  /* lists PGCs in group that were never entered. */
+  {
+    int i;
+    for (i = 0; i < group->nrpgcs; i++)
+        if (!group->pgcs[i].reached)
+          {
+            if (vts)
+                printf("  %s %d pgc %d\n", what, vts, i + 1);
+            else
+                printf("  %s pgc %d\n", what, i + 1);
+          } /*if; for*/
+  } /*reportunreached*/
+
+static int countreached(const struct navpgcgroup *group)
+  {
+    int i, count = 0;
+    for (i = 0; i < group->nrpgcs; i++)
+        if (group->pgcs[i].reached)
+            count++;
+    return count;
+  } /*countreached*/
+
+static void report(void)
+  /* prints out the results of the exploration. */
+  {
+    int i, reached, total;
+    printf("Playback states explored: %d%s\n", nrstates, nrstates == maxstates ? " (limit reached, exploration incomplete)" : "");
+    reached = countreached(&vmgm);
+    total = vmgm.nrpgcs;
+    for (i = 0; i < nrvts; i++)
+      {
+        reached += countreached(&vtsl[i].menus) + countreached(&vtsl[i].titles);
+        total += vtsl[i].menus.nrpgcs + vtsl[i].titles.nrpgcs;
+      } /*for*/
+    printf("PGCs reached: %d of %d\n", reached, total);
+    printf("\nHops by origin:      count   avg instrs   max instrs\n");
+    for (i = 0; i < ORIGIN_COUNT; i++)
+        if (nrhops[i])
+            printf
+              (
+                "  %-15s %10d %12.1f %12d\n",
+                originnames[i],
+                nrhops[i],
+                (double)totalhopinstrs[i] / nrhops[i],
+                maxhopinstrs[i]
+              );
+    printf("\nGPRM usage (instructions executed):\n");
+    for (i = 0; i < 16; i++)
+        if (gprmread[i] || gprmwritten[i])
+            printf("  g%-2d read %8ld  written %8ld\n", i, gprmread[i], gprmwritten[i]);
+    printf("  unused:");
+    for (i = 0; i < 16; i++)
+        if (!gprmread[i] && !gprmwritten[i])
+            printf(" g%d", i);
+    printf("\nSPRM usage (instructions executed, including implicit updates):\n");
+    for (i = 0; i < 24; i++)
+        if (sprmread[i] || sprmwritten[i])
+            printf("  s%-2d read %8ld  written %8ld\n", i, sprmread[i], sprmwritten[i]);
+    if (reached < total)
+      {
+        printf("\nUnreached PGCs:\n");
+        reportunreached(&vmgm, "VMGM", 0);
+        for (i = 0; i < nrvts; i++)
+          {
+            reportunreached(&vtsl[i].menus, "VTSM", i + 1);
+            reportunreached(&vtsl[i].titles, "VTS", i + 1);
+          } /*for*/
+      } /*if*/
+    if (nrslowest)
+      {
+        printf("\nSlowest hops:\n");
+        for (i = 0; i < nrslowest; i++)
+          {
+            printf("  %2d. ", i + 1);
+            printhop(stdout, &slowest[i]);
+          } /*for*/
+      } /*if*/
+    if (nrerrhops)
+      {
+        printf("\nErrors:\n");
+        for (i = 0; i < nrerrhops; i++)
+          {
+            printf("  ");
+            printhop(stdout, &errhops[i]);
+          } /*for*/
+      } /*if*/
+  } /*report*/
+
+int main(int argc, char **argv)
+  {
+    int opt;
+    char *videots;
+    struct stat info;
+    fputs(PACKAGE_HEADER("dvdnavsim"), stderr);
+    while (-1 != (opt = getopt(argc, argv, "hn:s:v")))
+      {
+        switch (opt)
+          {
+        case 'n':
+            maxslowest = strtounsigned(optarg, "number of hops to report");
+        break;
+        case 's':
+            maxstates = strtounsigned(optarg, "max playback states");
+        break;
+        case 'v':
+            verbose = true;
+        break;
+      // case 'h':
+        default:
+            fprintf(stderr,
+                    "usage: dvdnavsim [options] dvddir\n"
+                    "\t-n #: number of slowest hops to report (default 10)\n"
+                    "\t-s #: max number of playback states to explore (default 100000)\n"
+                    "\t-v: list every hop as it is executed\n"
+                    "\t-h: help\n"
+                );
+            exit(1);
+        break;
+          } /*switch*/
+      } /*while*/
+    if (optind + 1 != argc)
+      {
+        fprintf(stderr, "ERR:  Must specify exactly one DVD directory\n");
+        exit(1);
+      } /*if*/
+  /* accept either the VIDEO_TS directory or its parent */
+    videots = sprintf_alloc("%s/VIDEO_TS", argv[optind]);
+    if (stat(videots, &info) == 0 && S_ISDIR(info.st_mode))
+        dvddir = videots;
+    else
+      {
+        free(videots);
+        dvddir = argv[optind];
+      } /*if*/
+    slowest = malloc((maxslowest + 1) * sizeof(struct navhop));
+    loaddisc();
+    explore();
+    report();
+    return 0;
+  } /*main*/
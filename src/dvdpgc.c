@@ -58,56 +58,280 @@ for VTSM root menu:
 
 */
 
+/*
+The jumppad dispatches are generated as balanced compare trees over the sorted
+set of possible register values, rather than as a linear chain of comparisons:
+each jump then executes O(log n) instructions instead of O(n). The leaves of the
+tree are short linear runs of equality tests.
+*/
+
+#define JUMPTREE_LEAF 4 /* max nr of cases to test linearly at leaves of tree */
+
+struct jumpcase /* one possible outcome of a jumppad dispatch */
+  {
+    unsigned int key; /* value of dispatch register which selects this case */
+    int seq; /* order of definition, earlier takes precedence over later with same key */
+    unsigned char cmd[8]; /* unconditional instruction to execute for this case */
+  };
+
+struct jumptree /* state while generating a dispatch tree */
+  {
+    const unsigned char *obuf; /* start of command list, for computing line numbers */
+    unsigned char *cbuf; /* where to put next instruction */
+    int reg; /* GPRM containing value to dispatch on */
+    unsigned char **endfix; /* gotos which have to be pointed at the end of the tree */
+    int nrendfix;
+    bool endref; /* whether anything branches to the end of the tree */
+  };
+
+static void addjumpcase
+  (
+    struct jumpcase *cases,
+    int *nrcases,
+    unsigned int key,
+    unsigned char d0, unsigned char d1, unsigned char d2, unsigned char d3,
+    unsigned char d4, unsigned char d5, unsigned char d6, unsigned char d7
+  )
+  /* appends another case to the array. */
+  {
+    struct jumpcase * const thiscase = &cases[*nrcases];
+    thiscase->key = key;
+    thiscase->seq = *nrcases;
+    write8(thiscase->cmd, d0, d1, d2, d3, d4, d5, d6, d7);
+    ++*nrcases;
+  } /*addjumpcase*/
+
+static int jumpcasecompare(const void *a, const void *b)
+  /* sort comparator for jumpcases: by key, then by order of definition. */
+  {
+    const struct jumpcase * const ca = (const struct jumpcase *)a;
+    const struct jumpcase * const cb = (const struct jumpcase *)b;
+    return
+        ca->key != cb->key ?
+            (ca->key < cb->key ? -1 : 1)
+        :
+            ca->seq - cb->seq;
+  } /*jumpcasecompare*/
+
+static int jumptreeline(const struct jumptree *t)
+  /* returns the line number of the next instruction to be generated. */
+  {
+    return (t->cbuf - t->obuf) / 8 + 1;
+  } /*jumptreeline*/
+
+static void genjumpleaf
+  (
+    struct jumptree *t,
+    const struct jumpcase *cases,
+    int nrcases,
+    bool last /* nothing follows this leaf before the end of the tree */
+  )
+  /* generates a linear sequence of equality tests for the specified cases. */
+  {
+    int i;
+    for (i = 0; i < nrcases; i++)
+      {
+        const struct jumpcase * const thiscase = &cases[i];
+        const bool final = i == nrcases - 1;
+        unsigned char * const b = t->cbuf;
+        if (thiscase->cmd[0] == 0x20 || thiscase->cmd[0] == 0x71)
+          {
+          /* link or set-immediate, can take the comparison directly */
+            memcpy(b, thiscase->cmd, 8);
+            b[1] |= 0xA0; /* compare with immediate for equality */
+            if (thiscase->cmd[0] == 0x20)
+              {
+                b[3] = t->reg;
+                b[4] = thiscase->key >> 8;
+                b[5] = thiscase->key;
+              }
+            else
+              {
+                b[2] = t->reg;
+                b[6] = thiscase->key >> 8;
+                b[7] = thiscase->key;
+              } /*if*/
+            t->cbuf += 8;
+            if (final)
+              {
+                if (!last)
+                  {
+                    write8(t->cbuf, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+                      /* goto end of tree, filled in later */
+                    t->endfix[t->nrendfix++] = t->cbuf;
+                    t->cbuf += 8;
+                  } /*if*/
+                t->endref = true;
+              } /*if*/
+          }
+        else
+          {
+          /* jump commands can only compare registers, so branch around it instead */
+            write8(b, 0x00, 0xB1, 0x00, t->reg, thiscase->key >> 8, thiscase->key, 0x00, 0x00);
+              /* if reg != key goto past the instruction */
+            memcpy(b + 8, thiscase->cmd, 8);
+            t->cbuf += 16;
+            if (final)
+              {
+                if (!last)
+                    t->endfix[t->nrendfix++] = b;
+                else
+                    b[7] = jumptreeline(t);
+                t->endref = true;
+              }
+            else
+                b[7] = jumptreeline(t);
+          } /*if*/
+      } /*for*/
+  } /*genjumpleaf*/
+
+static void genjumpnode
+  (
+    struct jumptree *t,
+    const struct jumpcase *cases,
+    int nrcases,
+    bool last /* nothing follows this subtree before the end of the tree */
+  )
+  /* generates a balanced compare tree for the specified cases, which must be
+    sorted in order of increasing key with no duplicates. */
+  {
+    if (nrcases > JUMPTREE_LEAF)
+      {
+        const int mid = nrcases / 2;
+        unsigned char * const b = t->cbuf;
+        write8(b, 0x00, 0xC1, 0x00, t->reg, cases[mid].key >> 8, cases[mid].key, 0x00, 0x00);
+          /* if reg >= key goto upper half, filled in below */
+        t->cbuf += 8;
+        genjumpnode(t, cases, mid, false);
+        b[7] = jumptreeline(t);
+        genjumpnode(t, cases + mid, nrcases - mid, last);
+      }
+    else
+        genjumpleaf(t, cases, nrcases, last);
+  } /*genjumpnode*/
+
+static unsigned char *genjumptree
+  (
+    const unsigned char *obuf, /* start of command list, for computing line numbers */
+    unsigned char *cbuf, /* where to put the generated code */
+    int reg, /* GPRM containing value to dispatch on */
+    struct jumpcase *cases,
+    int nrcases,
+    bool needlanding /* whether to ensure there is an instruction at the end of the tree */
+  )
+  /* generates code to execute the instruction for the case whose key matches the
+    value in the specified GPRM, falling through to the end if none matches. Returns
+    a pointer past the generated code. Where several cases have the same key, the
+    first one defined takes precedence. */
+  {
+    struct jumptree t;
+    int i, j;
+    qsort(cases, nrcases, sizeof(struct jumpcase), jumpcasecompare);
+    for (i = 0, j = 0; i < nrcases; i++)
+        if (j == 0 || cases[i].key != cases[j - 1].key)
+            cases[j++] = cases[i];
+    nrcases = j;
+    t.obuf = obuf;
+    t.cbuf = cbuf;
+    t.reg = reg;
+    t.endfix = malloc(sizeof(unsigned char *) * (nrcases + 1));
+    if (t.endfix == 0)
+      {
+        fprintf(stderr, "ERR:  genjumptree: out of memory\n");
+        exit(1);
+      } /*if*/
+    t.nrendfix = 0;
+    t.endref = false;
+    genjumpnode(&t, cases, nrcases, true);
+    for (i = 0; i < t.nrendfix; i++)
+        t.endfix[i][7] = jumptreeline(&t);
+    if (t.endref && needlanding)
+      {
+      /* don't leave branches pointing past the end of the command list */
+        write8(t.cbuf, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00); // nop
+        t.cbuf += 8;
+      } /*if*/
+    free(t.endfix);
+    return t.cbuf;
+  } /*genjumptree*/
+
 static int genjumppad(unsigned char *buf, vtypes ismenu, int entry, const struct workset *ws, const struct pgcgroup *curgroup)
   /* generates the jumppad if the user wants it. The code is put into buf, and the function
     result is the number of bytes generated. */
   {
     unsigned char *cbuf = buf;
+    struct jumpcase *cases;
+    int nrcases;
     int i, j, k;
     if (jumppad && ismenu == VTYPE_VTSM && entry == 7 /* root menu? */)
       {
         // *** VTSM jumppad
         write8(cbuf,0x61,0x00,0x00,0x0E,0x00,0x0F,0x00,0x00); cbuf+=8; // g[14]=g[15];
         write8(cbuf,0x71,0x00,0x00,0x0F,0x00,0x00,0x00,0x00); cbuf+=8; // g[15]=0;
+        nrcases = 6 * curgroup->numpgcs + curgroup->numpgcs;
+        for (i = 0; i < ws->titles->numpgcs; i++)
+            nrcases += 1 + ws->titles->pgcs[i]->numchapters;
+        cases = malloc(sizeof(struct jumpcase) * nrcases);
+        if (cases == 0)
+          {
+            fprintf(stderr, "ERR:  genjumppad: out of memory\n");
+            exit(1);
+          } /*if*/
+        nrcases = 0;
         // menu entry jumptable
         for (i = 2; i < 8; i++)
           {
             for (j = 0; j < curgroup->numpgcs; j++)
                 if (curgroup->pgcs[j]->entries & (1 << i))
                   {
-                    write8(cbuf,0x20,0xA4,0x00,0x0E,i+120,0x00,0x00,j+1); cbuf+=8; // if g[14]==0xXX00 then LinkPGCN XX
+                    addjumpcase(cases, &nrcases, (i + 120) << 8, 0x20,0x04,0x00,0x00,0x00,0x00,0x00,j+1);
+                      // if g[14]==0xXX00 then LinkPGCN XX
                   } /*if; for*/
           } /*for*/
         // menu jumptable
         for (i = 0; i < curgroup->numpgcs; i++)
           {
-            write8(cbuf,0x20,0xA4,0x00,0x0E,i+1,0x00,0x00,i+1); cbuf+=8; // if g[14]==0xXX00 then LinkPGCN XX
+            addjumpcase(cases, &nrcases, (i + 1) << 8, 0x20,0x04,0x00,0x00,0x00,0x00,0x00,i+1);
+              // if g[14]==0xXX00 then LinkPGCN XX
           } /*for*/
         // title/chapter jumptable
         for (i = 0; i < ws->titles->numpgcs; i++)
           {
-            write8(cbuf,0x71,0x00,0x00,0x0D,i+129,0,0x00,0x00); cbuf+=8; // g[13]=(i+1)*256;
-            write8(cbuf,0x30,0x23,0x00,0x00,0x00,i+1,0x0E,0x0D); cbuf+=8; // if g[15]==g[13] then JumpSS VTSM i+1, ROOT
+            addjumpcase(cases, &nrcases, (i + 129) << 8, 0x30,0x03,0x00,0x00,0x00,i+1,0x00,0x00);
+              // if g[14]==(i+129)*256 then JumpVTS_TT i+1
             for (j = 0; j < ws->titles->pgcs[i]->numchapters; j++)
               {
-                write8(cbuf,0x71,0x00,0x00,0x0D,i+129,j+1,0x00,0x00); cbuf+=8; // g[13]=(i+1)*256;
-                write8(cbuf,0x30,0x25,0x00,j+1,0x00,i+1,0x0E,0x0D); cbuf+=8; // if g[15]==g[13] then JumpSS VTSM i+1, ROOT
+                addjumpcase(cases, &nrcases, (i + 129) << 8 | (j + 1), 0x30,0x05,0x00,j+1,0x00,i+1,0x00,0x00);
+                  // if g[14]==(i+129)*256+j+1 then JumpVTS_PTT i+1, j+1
               } /*for*/
           } /*for*/
+        cbuf = genjumptree(buf, cbuf, 0x0E, cases, nrcases, true);
+        free(cases);
       }
     else if (jumppad && ismenu == VTYPE_VMGM && entry == 2 /* title menu */)
       {
         // *** VMGM jumppad
         // remap all VMGM TITLE X -> TITLESET X TITLE Y
+        nrcases = 0;
+        for (i = 0; i < ws->titlesets->numvts; i++)
+            nrcases += ws->titlesets->vts[i].numtitles;
+        cases = malloc(sizeof(struct jumpcase) * (nrcases + ws->titlesets->numvts));
+        if (cases == 0)
+          {
+            fprintf(stderr, "ERR:  genjumppad: out of memory\n");
+            exit(1);
+          } /*if*/
+        nrcases = 0;
         k = 129;
         for (i = 0; i < ws->titlesets->numvts; i++)
             for (j = 0; j < ws->titlesets->vts[i].numtitles; j++)
               {
-                write8(cbuf, 0x71, 0xA0, 0x0F, 0x0F, j + 129, i + 2, k, 1);
+                addjumpcase(cases, &nrcases, k << 8 | 1, 0x71, 0x00, 0x00, 0x0F, j + 129, i + 2, 0x00, 0x00);
                   /* if g15 == k << 8 | 1 then g15 = j + 129 << 8 | i + 2 */
-                cbuf += 8;
                 k++;
               } /*for; for*/
+        cbuf = genjumptree(buf, cbuf, 0x0F, cases, nrcases, false);
+          /* always followed by code below */
         // move TITLE out of g[15] into g[14] (to mate up with CHAPTER)
         // then put title/chapter into g[15], and leave titleset in g[14]
         write8(cbuf,0x63,0x00,0x00,0x0E,0x00,0x0F,0x00,0x00); cbuf+=8; // g[14]+=g[15]
@@ -115,11 +339,15 @@ static int genjumppad(unsigned char *buf, vtypes ismenu, int entry, const struct
         write8(cbuf,0x64,0x00,0x00,0x0E,0x00,0x0F,0x00,0x00); cbuf+=8; // g[14]-=g[15]
         write8(cbuf,0x62,0x00,0x00,0x0E,0x00,0x0F,0x00,0x00); cbuf+=8; // g[14]<->g[15]
         // For each titleset, delegate to the appropriate submenu
+        nrcases = 0;
         for (i = 0; i < ws->titlesets->numvts; i++)
           {
-            write8(cbuf,0x71,0x00,0x00,0x0D,0x00,i+2,0x00,0x00); cbuf+=8; // g[13]=(i+2)*256;
-            write8(cbuf,0x30,0x26,0x00,0x01,i+1,0x87,0x0E,0x0D); cbuf+=8; // if g[14]==g[13] then JumpSS VTSM i+1, ROOT
+            addjumpcase(cases, &nrcases, i + 2, 0x30,0x06,0x00,0x01,i+1,0x87,0x00,0x00);
+              // if g[14]==i+2 then JumpSS VTSM i+1, ROOT
           } /*for*/
+        cbuf = genjumptree(buf, cbuf, 0x0E, cases, nrcases, false);
+          /* always followed by code below */
+        free(cases);
         // set g[15]=0 so we don't leak dirty registers to other PGC's
         write8(cbuf,0x71,0x00,0x00,0x0F,0x00,0x00,0x00,0x00); cbuf+=8; // g[15]=0;
       } /*if*/
@@ -26,6 +26,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h> /* for FICLONE */
+#endif
 
 #include "dvdauthor.h"
 #include "da-internal.h"
@@ -1116,6 +1120,469 @@ static void audio_scan_pcm(struct audchannel *ach,const unsigned char *buf,int l
     audiodesc_set_audio_attr(&ach->ad,&ach->adwarn,AUDIO_CHANNELS,attr);
 }
 
+/*
+    Reuse of output from an earlier menu or titleset. Scanning the same input
+    files with the same settings always produces the same output VOB files and
+    the same VOBU information, so when a later vobgroup in the same run matches
+    an earlier one, the earlier output files are copied (sharing their data blocks
+    if the filesystem allows) and the saved scan results restored, instead of
+    remultiplexing everything again.
+*/
+
+struct vobgroupattrs { /* the stream attribute fields of a struct vobgroup */
+    int numaudiotracks, numsubpicturetracks;
+    struct videodesc vd, vdwarn;
+    struct audiodesc ad[8], adwarn[8];
+    struct subpicdesc sp[32], spwarn[32];
+};
+
+struct savedvob { /* identifies the input to and saves the scan results for a vob */
+    char *fname; /* name of input file */
+    dev_t fdev;
+    ino_t fino;
+    off_t fsize;
+    bool hashed; /* whether hash has been computed yet */
+    uint64_t hash; /* of input file contents */
+    int pgcindex; /* index of first vob with the same progchain */
+    int colorsindex; /* index of first vob with the same progchain colours */
+    int numbuttons; /* in progchain */
+    char **buttonnames; /* array[numbuttons] */
+    int colorsbefore[16]; /* progchain colours before scanning */
+  /* results of scanning: */
+    int numvobus;
+    struct vobuinfo *vobu; /* array[numvobus] */
+    struct audchannel audch[64];
+    unsigned char buttoncoli[24];
+    int colorsafter[16];
+    struct button *buttons; /* array[numbuttons], only stream info filled in */
+};
+
+struct savedvobgroup { /* saved inputs and results of a FindVobus call */
+    struct savedvobgroup *next;
+    int firstoutnum; /* initial outnum, for naming output files */
+    struct vobgroupattrs attrsbefore, attrsafter;
+    int numvobs;
+    struct savedvob *vobs; /* array[numvobs] */
+    int numoutfiles;
+    char **outfiles; /* array[numoutfiles] of names of output VOB files */
+};
+
+static struct savedvobgroup *savedvobgroups = 0;
+
+static void getvobgroupattrs(struct vobgroupattrs *attrs, const struct vobgroup *va)
+  {
+    memset(attrs, 0, sizeof(struct vobgroupattrs)); /* so memcmp works */
+    attrs->numaudiotracks = va->numaudiotracks;
+    attrs->numsubpicturetracks = va->numsubpicturetracks;
+    memcpy(&attrs->vd, &va->vd, sizeof(struct videodesc));
+    memcpy(&attrs->vdwarn, &va->vdwarn, sizeof(struct videodesc));
+    memcpy(attrs->ad, va->ad, sizeof va->ad);
+    memcpy(attrs->adwarn, va->adwarn, sizeof va->adwarn);
+    memcpy(attrs->sp, va->sp, sizeof va->sp);
+    memcpy(attrs->spwarn, va->spwarn, sizeof va->spwarn);
+  } /*getvobgroupattrs*/
+
+static void setvobgroupattrs(struct vobgroup *va, const struct vobgroupattrs *attrs)
+  {
+    va->numaudiotracks = attrs->numaudiotracks;
+    va->numsubpicturetracks = attrs->numsubpicturetracks;
+    memcpy(&va->vd, &attrs->vd, sizeof(struct videodesc));
+    memcpy(&va->vdwarn, &attrs->vdwarn, sizeof(struct videodesc));
+    memcpy(va->ad, attrs->ad, sizeof va->ad);
+    memcpy(va->adwarn, attrs->adwarn, sizeof va->adwarn);
+    memcpy(va->sp, attrs->sp, sizeof va->sp);
+    memcpy(va->spwarn, attrs->spwarn, sizeof va->spwarn);
+  } /*setvobgroupattrs*/
+
+static char *strdupnull(const char *s)
+  {
+    return s != 0 ? strdup(s) : 0;
+  } /*strdupnull*/
+
+static void copyaudch(struct audchannel *dst, const struct audchannel *src)
+  /* copies 64 audchannel entries including their audpts arrays. */
+  {
+    int i;
+    for (i = 0; i < 64; i++)
+      {
+        dst[i] = src[i];
+        if (src[i].audpts)
+          {
+            dst[i].audpts = malloc(src[i].maxaudpts * sizeof(struct audpts));
+            memcpy(dst[i].audpts, src[i].audpts, src[i].numaudpts * sizeof(struct audpts));
+          } /*if*/
+      } /*for*/
+  } /*copyaudch*/
+
+static void copybuttonstreams(struct button *dst, const struct button *src, int numbuttons)
+  /* copies the stream info from src[numbuttons] to dst[numbuttons]. */
+  {
+    int i, j;
+    for (i = 0; i < numbuttons; i++)
+      {
+        dst[i].numstream = src[i].numstream;
+        for (j = 0; j < src[i].numstream; j++)
+          {
+            dst[i].stream[j] = src[i].stream[j];
+            dst[i].stream[j].up = strdupnull(src[i].stream[j].up);
+            dst[i].stream[j].down = strdupnull(src[i].stream[j].down);
+            dst[i].stream[j].left = strdupnull(src[i].stream[j].left);
+            dst[i].stream[j].right = strdupnull(src[i].stream[j].right);
+          } /*for*/
+      } /*for*/
+  } /*copybuttonstreams*/
+
+static bool hashinputfile(const char *fname, uint64_t *hash)
+  /* computes a 64-bit FNV-1a hash of the contents of the specified file. */
+  {
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+    const int fd = open(fname, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return false;
+    for (;;)
+      {
+        const ssize_t len = read(fd, bigwritebuf, BIGWRITEBUFLEN);
+          /* not otherwise in use between output files */
+        const unsigned char *p, *end;
+        if (len < 0)
+          {
+            close(fd);
+            return false;
+          } /*if*/
+        if (len == 0)
+            break;
+        end = bigwritebuf + len;
+        for (p = bigwritebuf; p < end; p++)
+            h = (h ^ *p) * UINT64_C(0x100000001b3);
+      } /*for*/
+    close(fd);
+    *hash = h;
+    return true;
+  } /*hashinputfile*/
+
+static ssize_t readfull(int fd, unsigned char *buf, size_t len)
+  /* reads up to len bytes, stopping short only at end of file. */
+  {
+    size_t done = 0;
+    while (done < len)
+      {
+        const ssize_t got = read(fd, buf + done, len - done);
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            break;
+        done += got;
+      } /*while*/
+    return done;
+  } /*readfull*/
+
+static bool comparefiles(const char *fname1, const char *fname2)
+  /* do the specified files have exactly the same contents? */
+  {
+    enum {chunksize = BIGWRITEBUFLEN / 2};
+    unsigned char * const buf1 = bigwritebuf; /* not otherwise in use between output files */
+    unsigned char * const buf2 = bigwritebuf + chunksize;
+    bool same = false;
+    const int fd1 = open(fname1, O_RDONLY | O_BINARY);
+    const int fd2 = open(fname2, O_RDONLY | O_BINARY);
+    if (fd1 >= 0 && fd2 >= 0)
+        for (;;)
+          {
+            const ssize_t len1 = readfull(fd1, buf1, chunksize);
+            const ssize_t len2 = readfull(fd2, buf2, chunksize);
+            if (len1 < 0 || len1 != len2 || memcmp(buf1, buf2, len1) != 0)
+                break;
+            if (len1 == 0)
+              {
+                same = true;
+                break;
+              } /*if*/
+          } /*for*/
+    if (fd1 >= 0)
+        close(fd1);
+    if (fd2 >= 0)
+        close(fd2);
+    return same;
+  } /*comparefiles*/
+
+static bool samecontents(struct savedvob *a, struct savedvob *b)
+  /* do a and b have the same input file contents? */
+  {
+    if (a->fsize != b->fsize)
+        return false;
+    if (a->fdev == b->fdev && a->fino == b->fino)
+        return true;
+    if (!a->hashed)
+        a->hashed = hashinputfile(a->fname, &a->hash);
+    if (!b->hashed)
+        b->hashed = hashinputfile(b->fname, &b->hash);
+    return
+            a->hashed && b->hashed && a->hash == b->hash
+        &&
+            comparefiles(a->fname, b->fname);
+              /* don't trust the hash alone, a collision would silently give the wrong output */
+  } /*samecontents*/
+
+static struct savedvobgroup *savedvobgroup_new(const struct vobgroup *va, int firstoutnum)
+  /* collects everything that determines the results of scanning the vobs in va,
+    or returns NULL if these cannot be saved for reuse. */
+  {
+    struct savedvobgroup *sg;
+    int i, j;
+    for (i = 0; i < va->numvobs; i++)
+      {
+        const char * const fname = va->vobs[i]->fname;
+        const struct pgc * const pg = va->vobs[i]->progchain;
+        struct stat statinfo;
+        if
+          (
+                !strcmp(fname, "-")
+            ||
+                fname[0] == '&'
+            ||
+                (fname[0] != '\0' && fname[strlen(fname) - 1] == '|')
+            ||
+                stat(fname, &statinfo) != 0
+            ||
+                !S_ISREG(statinfo.st_mode)
+          )
+            return 0; /* can only reuse output from ordinary files */
+        for (j = 0; j < pg->numbuttons; j++)
+            if (pg->buttons[j].numstream != 0)
+                return 0; /* already seen by a previous scan */
+      } /*for*/
+    sg = malloc(sizeof(struct savedvobgroup));
+    memset(sg, 0, sizeof(struct savedvobgroup));
+    sg->firstoutnum = firstoutnum;
+    getvobgroupattrs(&sg->attrsbefore, va);
+    sg->numvobs = va->numvobs;
+    sg->vobs = malloc(va->numvobs * sizeof(struct savedvob));
+    memset(sg->vobs, 0, va->numvobs * sizeof(struct savedvob));
+    for (i = 0; i < va->numvobs; i++)
+      {
+        struct savedvob * const sv = &sg->vobs[i];
+        const struct pgc * const pg = va->vobs[i]->progchain;
+        struct stat statinfo;
+        sv->fname = strdup(va->vobs[i]->fname);
+        stat(sv->fname, &statinfo);
+        sv->fdev = statinfo.st_dev;
+        sv->fino = statinfo.st_ino;
+        sv->fsize = statinfo.st_size;
+        for (sv->pgcindex = 0; va->vobs[sv->pgcindex]->progchain != pg; sv->pgcindex++)
+            /* find first vob with same progchain */;
+        for
+          (
+            sv->colorsindex = 0;
+            va->vobs[sv->colorsindex]->progchain->colors != pg->colors;
+            sv->colorsindex++
+          )
+            /* find first vob with same colours */;
+        sv->numbuttons = pg->numbuttons;
+        sv->buttonnames = malloc(pg->numbuttons * sizeof(char *));
+        for (j = 0; j < pg->numbuttons; j++)
+            sv->buttonnames[j] = strdup(pg->buttons[j].name);
+        memcpy(sv->colorsbefore, pg->colors->color, sizeof sv->colorsbefore);
+      } /*for*/
+    return sg;
+  } /*savedvobgroup_new*/
+
+static bool savedvobgroup_matches(struct savedvobgroup *saved, struct savedvobgroup *sg)
+  /* will scanning the vobs described by sg produce the same results as for saved? */
+  {
+    int i, j;
+    if
+      (
+            (saved->firstoutnum > 0) != (sg->firstoutnum > 0) /* output split the same way */
+        ||
+            memcmp(&saved->attrsbefore, &sg->attrsbefore, sizeof(struct vobgroupattrs)) != 0
+        ||
+            saved->numvobs != sg->numvobs
+      )
+        return false;
+    for (i = 0; i < sg->numvobs; i++)
+      {
+        const struct savedvob * const sv0 = &saved->vobs[i];
+        const struct savedvob * const sv = &sg->vobs[i];
+        if
+          (
+                sv0->fsize != sv->fsize
+            ||
+                sv0->pgcindex != sv->pgcindex
+            ||
+                sv0->colorsindex != sv->colorsindex
+            ||
+                sv0->numbuttons != sv->numbuttons
+            ||
+                memcmp(sv0->colorsbefore, sv->colorsbefore, sizeof sv->colorsbefore) != 0
+          )
+            return false;
+        for (j = 0; j < sv->numbuttons; j++)
+            if (strcmp(sv0->buttonnames[j], sv->buttonnames[j]))
+                return false;
+      } /*for*/
+  /* only compare contents once everything else matches */
+    for (i = 0; i < sg->numvobs; i++)
+        if (!samecontents(&saved->vobs[i], &sg->vobs[i]))
+            return false;
+    return true;
+  } /*savedvobgroup_matches*/
+
+static void savedvobgroup_addoutfile(struct savedvobgroup *sg, const char *fname)
+  /* records the name of another output file. */
+  {
+    sg->outfiles = realloc(sg->outfiles, (sg->numoutfiles + 1) * sizeof(char *));
+    sg->outfiles[sg->numoutfiles++] = strdup(fname);
+  } /*savedvobgroup_addoutfile*/
+
+static void savedvobgroup_save(struct savedvobgroup *sg, const struct vobgroup *va)
+  /* saves the results of scanning va, and makes sg available for reuse. */
+  {
+    int i;
+    getvobgroupattrs(&sg->attrsafter, va);
+    for (i = 0; i < va->numvobs; i++)
+      {
+        struct savedvob * const sv = &sg->vobs[i];
+        const struct vob * const thisvob = va->vobs[i];
+        sv->numvobus = thisvob->numvobus;
+        sv->vobu = malloc(thisvob->numvobus * sizeof(struct vobuinfo));
+        memcpy(sv->vobu, thisvob->vobu, thisvob->numvobus * sizeof(struct vobuinfo));
+        copyaudch(sv->audch, thisvob->audch);
+        memcpy(sv->buttoncoli, thisvob->buttoncoli, sizeof sv->buttoncoli);
+        memcpy(sv->colorsafter, thisvob->progchain->colors->color, sizeof sv->colorsafter);
+        sv->buttons = malloc(sv->numbuttons * sizeof(struct button));
+        memset(sv->buttons, 0, sv->numbuttons * sizeof(struct button));
+        copybuttonstreams(sv->buttons, thisvob->progchain->buttons, sv->numbuttons);
+      } /*for*/
+    sg->next = savedvobgroups;
+    savedvobgroups = sg;
+  } /*savedvobgroup_save*/
+
+static void savedvobgroup_free(struct savedvobgroup *sg)
+  /* frees an unsaved savedvobgroup, which has no scan results yet. */
+  {
+    int i, j;
+    for (i = 0; i < sg->numvobs; i++)
+      {
+        free(sg->vobs[i].fname);
+        for (j = 0; j < sg->vobs[i].numbuttons; j++)
+            free(sg->vobs[i].buttonnames[j]);
+        free(sg->vobs[i].buttonnames);
+      } /*for*/
+    free(sg->vobs);
+    for (i = 0; i < sg->numoutfiles; i++)
+        free(sg->outfiles[i]);
+    free(sg->outfiles);
+    free(sg);
+  } /*savedvobgroup_free*/
+
+static void copyoutfile(const char *srcname, const char *dstname)
+  /* makes the file dstname a copy of srcname, sharing the data blocks with it
+    if the filesystem supports that. */
+  {
+    int src, dst;
+    ssize_t len;
+    src = open(srcname, O_RDONLY | O_BINARY);
+    if (src < 0)
+      {
+        fprintf(stderr, "ERR:  Error %d opening %s: %s\n", errno, srcname, strerror(errno));
+        exit(1);
+      } /*if*/
+    dst = open(dstname, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY, 0666);
+    if (dst < 0)
+      {
+        fprintf(stderr, "ERR:  Error %d opening %s: %s\n", errno, dstname, strerror(errno));
+        exit(1);
+      } /*if*/
+#ifdef FICLONE
+    if (ioctl(dst, FICLONE, src) != 0)
+#endif
+      {
+#ifdef HAVE_COPY_FILE_RANGE
+        do
+            len = copy_file_range(src, NULL, dst, NULL, 1 << 30, 0);
+        while (len > 0);
+        if
+          (
+                len < 0
+            &&
+                errno != ENOSYS
+            &&
+                errno != EXDEV
+            &&
+                errno != EINVAL
+            &&
+                errno != EOPNOTSUPP
+          )
+          {
+            fprintf(stderr, "ERR:  Error %d copying %s to %s: %s\n", errno, srcname, dstname, strerror(errno));
+            exit(1);
+          } /*if*/
+#endif
+      /* copy whatever copy_file_range didn't, if anything */
+        for (;;)
+          {
+            len = read(src, bigwritebuf, BIGWRITEBUFLEN);
+            if (len < 0)
+              {
+                fprintf(stderr, "ERR:  Error %d reading %s: %s\n", errno, srcname, strerror(errno));
+                exit(1);
+              } /*if*/
+            if (len == 0)
+                break;
+            if (write(dst, bigwritebuf, len) != len)
+              {
+                fprintf(stderr, "ERR:  Error %d -- %s -- writing data\n", errno, strerror(errno));
+                exit(1);
+              } /*if*/
+          } /*for*/
+      }
+    close(src);
+    flushclose(dst);
+  } /*copyoutfile*/
+
+static void savedvobgroup_restore
+  (
+    const struct savedvobgroup *saved,
+    const struct savedvobgroup *sg,
+    struct vobgroup *va,
+    const char *fbase
+  )
+  /* copies the output files for saved into the ones for va, and fills in the scan
+    results for va as if it had been scanned again. */
+  {
+    int i, j;
+    fprintf(stderr, "\nSTAT: Same input as for %s, copying output\n", saved->outfiles[0]);
+    for (i = 0; i < saved->numoutfiles; i++)
+      {
+        char * const newname =
+            sg->firstoutnum >= 0 ?
+                sprintf_alloc("%s_%d.VOB", fbase, sg->firstoutnum + i)
+            :
+                strdup(fbase);
+        copyoutfile(saved->outfiles[i], newname);
+        free(newname);
+      } /*for*/
+    setvobgroupattrs(va, &saved->attrsafter);
+    for (i = 0; i < va->numvobs; i++)
+      {
+        const struct savedvob * const sv = &saved->vobs[i];
+        struct vob * const thisvob = va->vobs[i];
+        thisvob->vobid = i + 1;
+        thisvob->numvobus = sv->numvobus;
+        thisvob->maxvobus = sv->numvobus;
+        thisvob->vobu = malloc(sv->numvobus * sizeof(struct vobuinfo));
+        memcpy(thisvob->vobu, sv->vobu, sv->numvobus * sizeof(struct vobuinfo));
+        for (j = 0; j < sv->numvobus; j++)
+            thisvob->vobu[j].fnum += sg->firstoutnum - saved->firstoutnum;
+        copyaudch(thisvob->audch, sv->audch);
+        memcpy(thisvob->buttoncoli, sv->buttoncoli, sizeof sv->buttoncoli);
+        if (sv->colorsindex == i)
+            memcpy(thisvob->progchain->colors->color, sv->colorsafter, sizeof sv->colorsafter);
+        if (sv->pgcindex == i)
+            copybuttonstreams(thisvob->progchain->buttons, sv->buttons, sv->numbuttons);
+      } /*for*/
+  } /*savedvobgroup_restore*/
+
 int FindVobus(const char *fbase, struct vobgroup *va, vtypes ismenu)
   /* collects audio/video/subpicture information, remaps subpicture colours and generates
     output VOB files for a menu or titleset, complete except for the NAV packs. */
@@ -1133,7 +1600,23 @@ int FindVobus(const char *fbase, struct vobgroup *va, vtypes ismenu)
         unsigned char buf[6]; /* save partial packet in case it crosses sector boundaries */
       } mp2hdr[8]; /* enough for the allowed 8 audio streams */
     struct colorremap *crs;
+    struct savedvobgroup *sg = 0; /* for saving results for reuse */
 
+    if (fbase)
+      {
+        struct savedvobgroup *saved;
+        sg = savedvobgroup_new(va, outnum);
+        if (sg)
+          {
+            for (saved = savedvobgroups; saved; saved = saved->next)
+                if (savedvobgroup_matches(saved, sg))
+                  {
+                    savedvobgroup_restore(saved, sg, va, fbase);
+                    savedvobgroup_free(sg);
+                    return 1;
+                  } /*if; for*/
+          } /*if*/
+      } /*if*/
     crs = malloc(sizeof(struct colorremap) * 32); /* enough for 32 subpicture streams */
     for (vnum = 0; vnum < va->numvobs; vnum++)
       {
@@ -1434,6 +1917,8 @@ int FindVobus(const char *fbase, struct vobgroup *va, vtypes ismenu)
                         newname = strdup(fbase);
                       } /*if*/
                     writeopen(newname);
+                    if (sg)
+                        savedvobgroup_addoutfile(sg, newname);
                     free(newname);
                   } /*if*/
               } /*if*/
@@ -2012,6 +2497,13 @@ noshow:
     printvobustatus(va, cursect, true);
     fprintf(stderr, "\n");
     free(crs);
+    if (sg)
+      {
+        if (sg->numoutfiles != 0)
+            savedvobgroup_save(sg, va);
+        else
+            savedvobgroup_free(sg);
+      } /*if*/
     return 1;
   } /*FindVobus*/
 
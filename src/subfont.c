@@ -43,6 +43,8 @@
 #include "compat.h"
 
 #include <math.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include <netinet/in.h>
 
@@ -51,9 +53,6 @@
 
 #include FT_GLYPH_H
 
-#if (FREETYPE_MAJOR > 2) || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 1)
-#define HAVE_FREETYPE21
-#endif
 
 #if HAVE_FONTCONFIG
 #include <fontconfig/fontconfig.h>
@@ -67,7 +66,7 @@ static bool freetype_inited = false;
 static unsigned int const nr_colors = 256;
 static unsigned int const maxcolor = 255;
 static unsigned const first_char = 33; /* first non-printable, non-whitespace character */
-#define MAX_CHARSET_SIZE 60000 /* hope this is enough! */
+#define CHAR_NOT_LOOKED_UP -2 /* font_char.font value for entries not yet looked up */
 
 static FT_Library library;
 
@@ -97,6 +96,7 @@ static int const font_load_flags = FT_LOAD_MONOCHROME | FT_LOAD_RENDER;
   /* worth adding FT_LOAD_TARGET_MONO as well? */
 float text_font_scale_factor = 28.0; /* font size in font units */
 float subtitle_font_thickness = 3.0;  /*2.0*/
+char *glyph_cache_dir = NULL;
 colorspec
     subtitle_fill_color = {255, 255, 255, 255}, /* default opaque white */
     subtitle_outline_color = {0, 0, 0, 255}, /* default opaque black */
@@ -176,131 +176,777 @@ static void paste_bitmap
     int x, /* position from origin of bbuffer */
     int y, /* position from origin of bbuffer */
     int width, /* width of bbuffer */
-    int height, /* height of area to copy */
+    int height, /* height of bbuffer */
     int bwidth /* width of area to copy */
   )
-  /* copies pixels out of bitmap into bbuffer. Used to save glyph images as rendered
-    by FreeType into my cache. */
-  {
-    int drow = x + y * width;
-    int srow = 0;
-    int sp, dp, w, h;
-    if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO)
-      /* map one-bit-per-pixel source to indexed pixel */
-        for
-          (
-            h = bitmap->rows;
-            h > 0 && height > 0;
-            --h, height--, drow += width, srow += bitmap->pitch
-          )
-            for (w = bwidth, sp = dp = 0; w > 0; --w, ++dp, ++sp)
-                bbuffer[drow + dp] =
-                    (bitmap->buffer[srow + sp / 8] & 0x80 >> sp % 8) != 0 ?
-                        COLIDX_FILL
-                    :
-                        COLIDX_TRANSPARENT;
-    else
-      /* assume FT_PIXEL_MODE_GRAY */
-        for
+  /* copies pixels out of bitmap into bbuffer, clipped to the bounds of bbuffer.
+    Used to save glyph images as rendered by FreeType into my cache. */
+  {
+    int srow, sp, h;
+    for (h = 0, srow = 0; h < bitmap->rows; ++h, srow += bitmap->pitch)
+      {
+        unsigned char * const drow = bbuffer + (y + h) * width + x;
+        if (y + h < 0 || y + h >= height)
+            continue;
+        for (sp = 0; sp < bwidth; ++sp)
+          {
+            bool set;
+            if (x + sp < 0 || x + sp >= width)
+                continue;
+            if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO)
+              /* map one-bit-per-pixel source to indexed pixel */
+                set = (bitmap->buffer[srow + sp / 8] & 0x80 >> sp % 8) != 0;
+            else
+              /* assume FT_PIXEL_MODE_GRAY */
+                set = bitmap->buffer[srow + sp] >= 128;
+            drow[sp] = set ? COLIDX_FILL : COLIDX_TRANSPARENT;
+          } /*for*/
+      } /*for*/
+  } /*paste_bitmap*/
+
+static bool is_outline
+  (
+    const int * rowdist,
+    const int * halfwidth,
+    int maxradius,
+    int x,
+    int y,
+    int width,
+    int height
+  )
+  /* is the originally-transparent pixel at (x, y) to become part of the outline?
+    It does if it lies within subtitle_font_thickness of a fill pixel. rowdist gives
+    the horizontal distance from each pixel to the nearest fill pixel on the same
+    row, and halfwidth[maxradius - 1 + dy] the largest horizontal distance still
+    within the radius at a vertical distance of dy. */
+  {
+    int dy;
+    if (x + maxradius >= width || y + maxradius >= height)
+        return false; /* outline doesn't extend this far */
+    for (dy = 1 - maxradius; dy < maxradius; ++dy)
+        if
           (
-            h = bitmap->rows;
-            h > 0 && height > 0;
-            --h, height--, drow += width, srow += bitmap->pitch
+                y - dy >= 0
+            &&
+                y - dy < height
+            &&
+                rowdist[(y - dy) * width + x] <= halfwidth[maxradius - 1 + dy]
           )
-            for (w = bwidth, sp = dp = 0; w > 0; --w, ++dp, ++sp)
-                bbuffer[drow + dp] = bitmap->buffer[srow + sp] >= 128 ? COLIDX_FILL : COLIDX_TRANSPARENT;
-  } /*paste_bitmap*/
+            return true;
+    return false;
+  } /*is_outline*/
 
-static void add_outline
+static void add_outline_and_shadow
   (
     unsigned char * image,
     int width, /* dimensions of image */
     int height,
     int stride
   )
-  /* puts an outline around the text. */
+  /* puts an outline around the text, and adds a shadow to the text and outline
+    if one is wanted. The outline is a dilation of the text by a disc of radius
+    subtitle_font_thickness; this is done by measuring distances to fill pixels
+    along each row first, so each pixel only needs to look up one value per row
+    within the radius. */
   {
-    int x, y, x1, y1;
+    int x, y, dx, dy;
     const int maxradius = ceil(subtitle_font_thickness);
+    const bool shadow = subtitle_shadow_dx != 0 || subtitle_shadow_dy != 0;
+    int * rowdist, * halfwidth;
+    if (maxradius <= 0 && !shadow)
+        return;
+    rowdist = malloc(width * height * sizeof(int));
+    halfwidth = malloc((maxradius > 0 ? 2 * maxradius - 1 : 1) * sizeof(int));
+    for (dy = 1 - maxradius; dy < maxradius; ++dy)
+      {
+      /* find extent of disc at each vertical distance, -1 if none */
+        for
+          (
+            dx = 0;
+            dy * dy + dx * dx < subtitle_font_thickness * subtitle_font_thickness;
+            ++dx
+          )
+          /* keep looking */;
+        halfwidth[maxradius - 1 + dy] = dx - 1;
+      } /*for*/
     for (y = 0; y < height; ++y)
       {
+      /* distances to nearest fill pixel to the left, then to the right; anything
+        at least maxradius away is too far to matter */
+        const unsigned char * const row = image + y * stride;
+        int * const dist = rowdist + y * width;
+        int d = maxradius;
         for (x = 0; x < width; ++x)
           {
-            if (image[y * stride + x] == COLIDX_FILL)
-              {
-                for
-                  (
-                    y1 = y >= maxradius ? y - maxradius : 0;
-                    y1 < y + maxradius && y1 + maxradius < height;
-                    ++y1
-                  )
-                  {
-                    for
-                      (
-                        x1 = x >= maxradius ? x - maxradius : 0;
-                        x1 < x + maxradius && x1 + maxradius < width;
-                        ++x1
-                      )
-                      {
-                        if
-                          (
-                                image[y1 * stride + x1] == COLIDX_TRANSPARENT
-                            &&
-                                    (y1 - y) * (y1 - y) + (x1 - x) * (x1 - x)
-                                <
-                                    subtitle_font_thickness * subtitle_font_thickness
-                          )
-                          {
-                            image[y1 * stride + x1] = COLIDX_OUTLINE;
-                          } /*if*/
-                      } /*for*/
-                  } /*for*/
-              } /*if*/
+            if (row[x] == COLIDX_FILL)
+                d = 0;
+            else if (d < maxradius)
+                ++d;
+            dist[x] = d;
+          } /*for*/
+        d = maxradius;
+        for (x = width; --x >= 0;)
+          {
+            if (row[x] == COLIDX_FILL)
+                d = 0;
+            else if (d < maxradius)
+                ++d;
+            if (d < dist[x])
+                dist[x] = d;
           } /*for*/
       } /*for*/
-  } /*add_outline*/
+    for (y = 0; y < height; ++y)
+      {
+        for (x = 0; x < width; ++x)
+          {
+            unsigned char * const pix = image + y * stride + x;
+            const int srcx = x - subtitle_shadow_dx, srcy = y - subtitle_shadow_dy;
+            if (*pix != COLIDX_TRANSPARENT)
+                continue;
+            if (is_outline(rowdist, halfwidth, maxradius, x, y, width, height))
+                *pix = COLIDX_OUTLINE;
+            else if
+              (
+                    shadow
+                &&
+                    srcx >= 0
+                &&
+                    srcx < width
+                &&
+                    srcy >= 0
+                &&
+                    srcy < height
+                &&
+                    (
+                        image[srcy * stride + srcx] == COLIDX_FILL
+                    ||
+                        /* note outline pixels never become shadow, so
+                          source pixel must have originally been transparent */
+                        is_outline(rowdist, halfwidth, maxradius, srcx, srcy, width, height)
+                    )
+              )
+                *pix = COLIDX_SHADOW;
+          } /*for*/
+      } /*for*/
+    free(rowdist);
+    free(halfwidth);
+  } /*add_outline_and_shadow*/
 
-static void add_shadow
-  (
-    unsigned char * image,
-    int width, /* dimensions of image */
-    int height,
-    int stride
-  )
-  /* adds a shadow to the text. */
+font_char *get_font_char(font_desc_t *desc, int c)
+  /* returns the information for rendering Unicode character c, looking it up
+    in the font if this is the first time it has been asked for. */
   {
+    font_char *block, *fc;
+    if (c < 0 || c >= FONT_MAXCHAR)
+        c = desc->substchar;
+    block = desc->chars[c / FONT_CHARBLOCK];
+    if (block == NULL)
+      {
+        int i;
+        block = malloc(FONT_CHARBLOCK * sizeof(font_char));
+        for (i = 0; i < FONT_CHARBLOCK; i++)
+            block[i].font = CHAR_NOT_LOOKED_UP;
+        desc->chars[c / FONT_CHARBLOCK] = block;
+      } /*if*/
+    fc = block + c % FONT_CHARBLOCK;
+    if (fc->font == CHAR_NOT_LOOKED_UP)
+      {
+        FT_UInt glyph_index = 0;
+        fc->image = NULL; /* no glyph image cached yet */
+        fc->width = -1;
+        fc->glyph_index = 0;
+        if (c != ' ' && c >= first_char)
+            glyph_index = FT_Get_Char_Index(desc->faces[0], c);
+        if (glyph_index != 0)
+          {
+            fc->font = 0;
+            fc->glyph_index = glyph_index;
+          }
+        else if (c == ' ' || c == desc->substchar)
+          {
+          /* no glyph image, just takes up space */
+            fc->font = -1;
+            fc->width = desc->spacewidth;
+          }
+        else
+          {
+          /* show substitute character instead */
+            const font_char * const subst = get_font_char(desc, desc->substchar);
+            if (c >= first_char)
+                WARNING("Glyph for char U+%04X|%c not found.",
+                    (unsigned int)c,
+                    c > 255 ? '.' : c);
+            fc->font = subst->font;
+            fc->image = subst->image;
+            fc->width = subst->width;
+          } /*if*/
+      } /*if*/
+    return fc;
+  } /*get_font_char*/
+
+/*
+    Glyph images are packed one after another into large slabs of memory,
+    each taking up only as much space as its trimmed image needs. Slabs are
+    never reallocated, so glyph images stay where they are once rendered.
+*/
+
+#define GLYPH_SLAB_SIZE 65536 /* normal size of a slab */
+
+struct glyph_slab
+  {
+    struct glyph_slab *next; /* previously-allocated slab */
+    size_t size, used; /* allocated and used bytes in data */
+    unsigned char data[];
+  };
+
+static glyph_image *alloc_glyph_image(raw_file *pic_b, int width, int height)
+  /* allocates space for a glyph image of the specified dimensions. */
+  {
+    const size_t size = ALIGN_8BYTES(sizeof(glyph_image) + width * height);
+    struct glyph_slab *slab = pic_b->slabs;
+    glyph_image *image;
+    if (slab == NULL || slab->size - slab->used < size)
+      {
+      /* start a new slab, leaving the rest of the current one unused */
+        const size_t slabsize = size > GLYPH_SLAB_SIZE ? size : GLYPH_SLAB_SIZE;
+        slab = malloc(sizeof(struct glyph_slab) + slabsize);
+        if (slab == NULL)
+          {
+            fprintf(stderr, "ERR:  Failed to allocate memory\n");
+            exit(1);
+          } /*if*/
+        slab->next = pic_b->slabs;
+        slab->size = slabsize;
+        slab->used = 0;
+        pic_b->slabs = slab;
+      } /*if*/
+    image = (glyph_image *)(slab->data + slab->used);
+    slab->used += size;
+    image->width = width;
+    image->height = height;
+    return image;
+  } /*alloc_glyph_image*/
+
+static const glyph_image *save_glyph_image(raw_file *pic_b, int width)
+  /* makes a glyph image from the non-transparent pixels within the leftmost
+    width columns of pic_b->cell. */
+  {
+    const int stride = pic_b->w;
+    int left = width, right = 0, top = pic_b->charheight, bottom = 0;
     int x, y;
-    for
-      (
-        y = subtitle_shadow_dy < 0 ? -subtitle_shadow_dy : 0;
-        y < (subtitle_shadow_dy > 0 ? height - subtitle_shadow_dy : height);
-        ++y
-      )
+    glyph_image *image;
+    for (y = 0; y < pic_b->charheight; y++)
       {
-        for
+        const unsigned char * const row = pic_b->cell + y * stride;
+        for (x = 0; x < width; x++)
+            if (row[x] != COLIDX_TRANSPARENT)
+              {
+                if (x < left)
+                    left = x;
+                if (x >= right)
+                    right = x + 1;
+                if (y < top)
+                    top = y;
+                bottom = y + 1;
+              } /*if; for*/
+      } /*for*/
+    if (right <= left)
+      {
+      /* nothing to see */
+        left = right = top = bottom = 0;
+      } /*if*/
+    image = alloc_glyph_image(pic_b, right - left, bottom - top);
+    image->left = left;
+    image->top = top;
+    for (y = top; y < bottom; y++)
+        memcpy(image->pixels + (y - top) * image->width, pic_b->cell + y * stride + left, image->width);
+    return image;
+  } /*save_glyph_image*/
+
+static void free_glyph_images(raw_file *pic_b)
+  /* frees up all the glyph images allocated for pic_b. */
+  {
+    while (pic_b->slabs != NULL)
+      {
+        struct glyph_slab * const slab = pic_b->slabs;
+        pic_b->slabs = slab->next;
+        free(slab);
+      } /*while*/
+  } /*free_glyph_images*/
+
+static int horiz_resolution(void)
+  /* horizontal resolution in dots per inch at which to render glyphs, allowing for
+    non-square pixels. */
+  {
+    return
+        widescreen ?
+            54 /* = 72 * (4 / 3) / (16 / 9) */
+        :
+            72;
+  } /*horiz_resolution*/
+
+static int vert_resolution(void)
+  /* vertical resolution in dots per inch at which to render glyphs. */
+  {
+    return
+        default_video_format == VF_NTSC ?
+            64 /* = 72 * 480 / 540 */
+        : /* default_video_format == VF_PAL ? */
+            77; /* = 72 * 576 / 540 */
+  } /*vert_resolution*/
+
+/*
+    Kerning values are remembered in a hash table keyed by pair of glyph
+    indexes, so laying out text does not need to ask FreeType again for pairs
+    already seen.
+*/
+
+struct kern_entry
+  {
+    bool used; /* whether this entry is occupied */
+    FT_UInt left, right; /* glyph indexes */
+    int kern; /* in pixels */
+  };
+
+static kern_entry *find_kern(font_desc_t *desc, FT_UInt left, FT_UInt right)
+  /* returns the hash table entry for the specified pair of glyph indexes, or
+    the unused entry where it should be put. desc->kerns must not be empty. */
+  {
+    unsigned int i = (left * 0x9e3779b1U ^ right) * 0x85ebca6bU;
+    while (true)
+      {
+        kern_entry * const entry = desc->kerns + (i & (desc->allockerns - 1));
+        if (!entry->used || (entry->left == left && entry->right == right))
+            return entry;
+        ++i;
+      } /*while*/
+  } /*find_kern*/
+
+static void add_kern(font_desc_t *desc, FT_UInt left, FT_UInt right, int kern)
+  /* adds a kerning value to the hash table, growing it as necessary. */
+  {
+    kern_entry *entry;
+    if (desc->nrkerns + 1 > desc->allockerns * 3 / 4)
+      {
+        kern_entry * const oldkerns = desc->kerns;
+        const int oldalloc = desc->allockerns;
+        int i;
+        desc->allockerns = oldalloc != 0 ? oldalloc * 2 : 256;
+        desc->kerns = calloc(desc->allockerns, sizeof(kern_entry));
+        if (desc->kerns == NULL)
+          {
+            fprintf(stderr, "ERR:  Failed to allocate memory\n");
+            exit(1);
+          } /*if*/
+        for (i = 0; i < oldalloc; i++)
+            if (oldkerns[i].used)
+                *find_kern(desc, oldkerns[i].left, oldkerns[i].right) = oldkerns[i];
+        free(oldkerns);
+      } /*if*/
+    entry = find_kern(desc, left, right);
+    if (!entry->used)
+      {
+        entry->used = true;
+        entry->left = left;
+        entry->right = right;
+        entry->kern = kern;
+        desc->nrkerns++;
+      } /*if*/
+  } /*add_kern*/
+
+/*
+    On-disk cache of rendered glyphs. When glyph_cache_dir is set, the finished
+    glyph images (with outline and shadow already added), their advance widths and
+    any kerning values looked up are saved to a file in that directory when the
+    font is disposed of, and loaded again the next time the same font file is used
+    with the same rendering parameters, so glyphs found there need not go through
+    FreeType at all.
+
+    Cache file format: a header line identifying the format, a key line identifying
+    the font file and rendering parameters, then a count of glyphs and a count of
+    kerning pairs, followed by the glyph and kerning records. Each glyph record
+    holds the character code, advance width and position and size of the glyph
+    image, followed by its pixels. All binary fields are 32-bit integers in network
+    byte order.
+*/
+
+static const char glyphcache_magic[] = "dvdauthor glyph cache 3\n";
+
+typedef struct /* a cached glyph image */
+  {
+    unsigned int c; /* Unicode character code */
+    int width; /* advance width, as for font_char.width */
+    int left, top, imgwidth, imgheight; /* as for glyph_image */
+    const unsigned char *pixels; /* points into glyphcache.data */
+  } glyphcache_glyph;
+
+struct glyphcache
+  {
+    char *filename; /* cache file to load from/save to */
+    char *key; /* identifies font and rendering parameters, including trailing newline */
+    unsigned char *data; /* contents of loaded cache file */
+    glyphcache_glyph *glyphs; /* array [nrglyphs] sorted by c, loaded from cache file */
+    int nrglyphs;
+    unsigned int *newglyphs; /* array [nrnewglyphs] of characters rendered since loading */
+    int nrnewglyphs, allocnewglyphs;
+    int nrnewkerns; /* nr kerning values looked up since loading */
+  };
+
+static uint64_t fnv64(uint64_t hash, const unsigned char *data, size_t len)
+  /* continues computing an FNV-1a hash of a sequence of bytes. */
+  {
+    while (len != 0)
+      {
+        hash ^= *data++;
+        hash *= 0x100000001b3ULL;
+        --len;
+      } /*while*/
+    return hash;
+  } /*fnv64*/
+
+static const uint64_t fnv64_init = 0xcbf29ce484222325ULL;
+
+static int glyphcache_hash_file(const char *filename, uint64_t *hash, long *size)
+  /* computes a hash of the entire contents of the specified file. */
+  {
+    unsigned char buf[65536];
+    size_t nrbytes;
+    FILE * const f = fopen(filename, "rb");
+    if (f == NULL)
+        return -1;
+    *hash = fnv64_init;
+    *size = 0;
+    while ((nrbytes = fread(buf, 1, sizeof buf, f)) != 0)
+      {
+        *hash = fnv64(*hash, buf, nrbytes);
+        *size += nrbytes;
+      } /*while*/
+    if (ferror(f))
+      {
+        fclose(f);
+        return -1;
+      } /*if*/
+    fclose(f);
+    return 0;
+  } /*glyphcache_hash_file*/
+
+static uint32_t glyphcache_getint(const unsigned char **data)
+  /* extracts a 32-bit integer in network byte order and advances past it. */
+  {
+    uint32_t val;
+    memcpy(&val, *data, 4);
+    *data += 4;
+    return ntohl(val);
+  } /*glyphcache_getint*/
+
+static void glyphcache_putint(FILE *f, uint32_t val)
+  /* writes a 32-bit integer in network byte order. */
+  {
+    val = htonl(val);
+    fwrite(&val, 4, 1, f);
+  } /*glyphcache_putint*/
+
+static int compare_glyphs(const void *a, const void *b)
+  {
+    const unsigned int ca = ((const glyphcache_glyph *)a)->c;
+    const unsigned int cb = ((const glyphcache_glyph *)b)->c;
+    return ca < cb ? -1 : ca > cb ? 1 : 0;
+  } /*compare_glyphs*/
+
+static void glyphcache_load(font_desc_t *desc, struct glyphcache *cache, const raw_file *pic_b)
+  /* loads previously-saved glyphs from the cache file, if it exists and matches
+    the current key. */
+  {
+    FILE *f;
+    struct stat st;
+    const unsigned char *data, *dataend;
+    const size_t keylen = strlen(cache->key);
+    int nrglyphs, nrkerns, i;
+    bool ok;
+    f = fopen(cache->filename, "rb");
+    if (f == NULL)
+        return;
+    if (fstat(fileno(f), &st) != 0 || st.st_size < sizeof glyphcache_magic - 1 + keylen + 8)
+      {
+        fclose(f);
+        return;
+      } /*if*/
+    cache->data = malloc(st.st_size);
+    if (fread(cache->data, 1, st.st_size, f) != st.st_size)
+      {
+        fclose(f);
+        free(cache->data);
+        cache->data = NULL;
+        return;
+      } /*if*/
+    fclose(f);
+    data = cache->data;
+    dataend = data + st.st_size;
+    do /*once*/
+      {
+        if
           (
-            x = subtitle_shadow_dx < 0 ? -subtitle_shadow_dx : 0;
-            x < (subtitle_shadow_dx > 0 ? width - subtitle_shadow_dx : width);
-            ++x
+                memcmp(data, glyphcache_magic, sizeof glyphcache_magic - 1) != 0
+            ||
+                memcmp(data + sizeof glyphcache_magic - 1, cache->key, keylen) != 0
           )
+            break; /* different format or different font/parameters */
+        data += sizeof glyphcache_magic - 1 + keylen;
+        nrglyphs = glyphcache_getint(&data);
+        nrkerns = glyphcache_getint(&data);
+        if (nrglyphs < 0 || nrkerns < 0 || (dataend - data) / 24 < nrglyphs)
+            break; /* corrupted */
+        cache->glyphs = malloc(nrglyphs * sizeof(glyphcache_glyph));
+        ok = true;
+        for (i = 0; i < nrglyphs; i++)
           {
-            const int dstpix = (y + subtitle_shadow_dy) * stride + (x + subtitle_shadow_dx);
+            glyphcache_glyph * const glyph = cache->glyphs + i;
+            if (dataend - data < 24)
+              {
+                ok = false;
+                break;
+              } /*if*/
+            glyph->c = glyphcache_getint(&data);
+            glyph->width = glyphcache_getint(&data);
+            glyph->left = glyphcache_getint(&data);
+            glyph->top = glyphcache_getint(&data);
+            glyph->imgwidth = glyphcache_getint(&data);
+            glyph->imgheight = glyphcache_getint(&data);
             if
               (
-                    (
-                        image[y * stride + x] == COLIDX_FILL
-                    ||
-                        image[y * stride + x] == COLIDX_OUTLINE
-                    )
-                &&
-                    image[dstpix] == COLIDX_TRANSPARENT
+                    glyph->left < 0
+                ||
+                    glyph->top < 0
+                ||
+                    glyph->imgwidth < 0
+                ||
+                    glyph->imgheight < 0
+                ||
+                    glyph->imgwidth > pic_b->charwidth - glyph->left
+                ||
+                    glyph->imgheight > pic_b->charheight - glyph->top
+                ||
+                    dataend - data < glyph->imgwidth * glyph->imgheight
               )
               {
-                image[dstpix] = COLIDX_SHADOW;
+                ok = false;
+                break;
               } /*if*/
+            glyph->pixels = data;
+            data += glyph->imgwidth * glyph->imgheight;
           } /*for*/
-      } /*for*/
-  } /*add_shadow*/
+        if (!ok || dataend - data != (size_t)nrkerns * 12)
+          {
+          /* truncated or corrupted */
+            free(cache->glyphs);
+            cache->glyphs = NULL;
+            break;
+          } /*if*/
+        cache->nrglyphs = nrglyphs;
+        qsort(cache->glyphs, nrglyphs, sizeof(glyphcache_glyph), compare_glyphs);
+        for (i = 0; i < nrkerns; i++)
+          {
+            const FT_UInt left = glyphcache_getint(&data);
+            const FT_UInt right = glyphcache_getint(&data);
+            const int kern = (int32_t)glyphcache_getint(&data);
+            add_kern(desc, left, right, kern);
+          } /*for*/
+        return;
+      }
+    while (false);
+    fprintf(stderr, "WARN: ignoring out-of-date glyph cache file %s\n", cache->filename);
+    free(cache->data);
+    cache->data = NULL;
+  } /*glyphcache_load*/
+
+static void glyphcache_open
+  (
+    font_desc_t *desc,
+    const char *fontfile, /* font file that desc->faces[0] was loaded from */
+    float ppem,
+    float thickness
+  )
+  /* sets up desc->glyphcache and loads any previously-saved glyphs for this font
+    and rendering parameters, if a glyph cache directory has been specified. */
+  {
+    const raw_file * const pic_b = desc->pic_b[0];
+    struct glyphcache *cache;
+    uint64_t filehash;
+    long filesize;
+    char key[256];
+    if (glyph_cache_dir == NULL)
+        return;
+    if (glyphcache_hash_file(fontfile, &filehash, &filesize) != 0)
+      {
+        fprintf(stderr, "WARN: cannot read font file %s for glyph cache\n", fontfile);
+        return;
+      } /*if*/
+    if (mkdir(glyph_cache_dir, 0777) != 0 && errno != EEXIST)
+      {
+        fprintf
+          (
+            stderr,
+            "WARN: cannot create glyph cache directory %s: %s\n",
+            glyph_cache_dir,
+            strerror(errno)
+          );
+        return;
+      } /*if*/
+    snprintf
+      (
+        key,
+        sizeof key,
+        "font %016" PRIx64 " %ld ppem %a movie %dx%d widescreen %d resolution %dx%d"
+            " cell %dx%d baseline %d padding %d"
+            " thickness %a shadow %d,%d flags %#x freetype %d.%d.%d\n",
+        filehash, filesize, ppem, movie_width, movie_height,
+        widescreen, horiz_resolution(), vert_resolution(),
+        pic_b->charwidth, pic_b->charheight, pic_b->baseline, pic_b->padding,
+        thickness, subtitle_shadow_dx, subtitle_shadow_dy, font_load_flags,
+        FREETYPE_MAJOR, FREETYPE_MINOR, FREETYPE_PATCH
+      );
+    cache = calloc(1, sizeof(struct glyphcache));
+    cache->key = strdup(key);
+    cache->filename = malloc(strlen(glyph_cache_dir) + 16 + 9);
+    sprintf
+      (
+        cache->filename,
+        "%s/%016" PRIx64 ".glyphs",
+        glyph_cache_dir,
+        fnv64(fnv64_init, (const unsigned char *)key, strlen(key))
+      );
+    glyphcache_load(desc, cache, pic_b);
+    desc->glyphcache = cache;
+  } /*glyphcache_open*/
+
+static void glyphcache_close(font_desc_t *desc)
+  /* saves any newly-rendered glyphs and kerning values to the cache file, and
+    disposes of desc->glyphcache. */
+  {
+    struct glyphcache * const cache = desc->glyphcache;
+    if (cache == NULL)
+        return;
+    if (cache->nrnewglyphs + cache->nrnewkerns != 0)
+      {
+      /* write out old and new entries to a temporary file, then rename it over
+        the cache file, so concurrent runs never see a partially-written file */
+        char * const tempname = malloc(strlen(cache->filename) + 24);
+        int fd, i;
+        FILE *f = NULL;
+        bool ok = false;
+        sprintf(tempname, "%s.%ld", cache->filename, (long)getpid());
+        fd = open(tempname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+        if (fd >= 0)
+            f = fdopen(fd, "wb");
+        if (f != NULL)
+          {
+            fputs(glyphcache_magic, f);
+            fputs(cache->key, f);
+            glyphcache_putint(f, cache->nrglyphs + cache->nrnewglyphs);
+            glyphcache_putint(f, desc->nrkerns);
+            for (i = 0; i < cache->nrglyphs; i++)
+              {
+                const glyphcache_glyph * const glyph = cache->glyphs + i;
+                glyphcache_putint(f, glyph->c);
+                glyphcache_putint(f, glyph->width);
+                glyphcache_putint(f, glyph->left);
+                glyphcache_putint(f, glyph->top);
+                glyphcache_putint(f, glyph->imgwidth);
+                glyphcache_putint(f, glyph->imgheight);
+                fwrite(glyph->pixels, glyph->imgwidth * glyph->imgheight, 1, f);
+              } /*for*/
+            for (i = 0; i < cache->nrnewglyphs; i++)
+              {
+                const font_char * const fc = get_font_char(desc, cache->newglyphs[i]);
+                const glyph_image * const image = fc->image;
+                glyphcache_putint(f, cache->newglyphs[i]);
+                glyphcache_putint(f, fc->width);
+                glyphcache_putint(f, image->left);
+                glyphcache_putint(f, image->top);
+                glyphcache_putint(f, image->width);
+                glyphcache_putint(f, image->height);
+                fwrite(image->pixels, image->width * image->height, 1, f);
+              } /*for*/
+            for (i = 0; i < desc->allockerns; i++)
+              {
+                const kern_entry * const entry = desc->kerns + i;
+                if (entry->used)
+                  {
+                    glyphcache_putint(f, entry->left);
+                    glyphcache_putint(f, entry->right);
+                    glyphcache_putint(f, entry->kern);
+                  } /*if*/
+              } /*for*/
+            ok = !ferror(f);
+            ok = fclose(f) == 0 && ok;
+          }
+        else if (fd >= 0)
+          {
+            close(fd);
+          } /*if*/
+        if (ok)
+            ok = rename(tempname, cache->filename) == 0;
+        if (!ok)
+          {
+            fprintf
+              (
+                stderr,
+                "WARN: cannot save glyph cache file %s: %s\n",
+                cache->filename,
+                strerror(errno)
+              );
+            if (fd >= 0)
+                unlink(tempname);
+          } /*if*/
+        free(tempname);
+      } /*if*/
+    free(cache->filename);
+    free(cache->key);
+    free(cache->data);
+    free(cache->glyphs);
+    free(cache->newglyphs);
+    free(cache);
+    desc->glyphcache = NULL;
+  } /*glyphcache_close*/
+
+static bool glyphcache_getglyph(font_desc_t *desc, int c, font_char *fc)
+  /* tries to fill in the image for character c from the glyph cache, returning
+    true on success. */
+  {
+    struct glyphcache * const cache = desc->glyphcache;
+    raw_file * const pic_b = desc->pic_b[fc->font];
+    glyphcache_glyph key;
+    const glyphcache_glyph *found;
+    glyph_image *image;
+    if (cache == NULL || cache->nrglyphs == 0)
+        return false;
+    key.c = c;
+    found = bsearch(&key, cache->glyphs, cache->nrglyphs, sizeof(glyphcache_glyph), compare_glyphs);
+    if (found == NULL)
+        return false;
+    image = alloc_glyph_image(pic_b, found->imgwidth, found->imgheight);
+    image->left = found->left;
+    image->top = found->top;
+    memcpy(image->pixels, found->pixels, found->imgwidth * found->imgheight);
+    fc->image = image;
+    fc->width = found->width;
+    return true;
+  } /*glyphcache_getglyph*/
+
+static void glyphcache_putglyph(font_desc_t *desc, int c)
+  /* remembers that the image for character c has been newly rendered, so it
+    can be saved to the glyph cache. */
+  {
+    struct glyphcache * const cache = desc->glyphcache;
+    if (cache == NULL)
+        return;
+    if (cache->nrnewglyphs == cache->allocnewglyphs)
+      {
+        cache->allocnewglyphs = cache->allocnewglyphs != 0 ? cache->allocnewglyphs * 2 : 64;
+        cache->newglyphs = realloc(cache->newglyphs, cache->allocnewglyphs * sizeof(unsigned int));
+      } /*if*/
+    cache->newglyphs[cache->nrnewglyphs++] = c;
+  } /*glyphcache_putglyph*/
 
 void render_one_glyph(font_desc_t *desc, int c)
   /* renders the glyph corresponding to Unicode character code c and saves the
@@ -310,27 +956,29 @@ void render_one_glyph(font_desc_t *desc, int c)
     FT_UInt glyph_index;
     FT_Glyph oglyph;
     FT_BitmapGlyph glyph;
-    int width, height, stride, maxw, off;
-    unsigned char *bbuffer;
+    int width, height, stride, maxw;
     int pen_xa;
-    const int font = desc->font[c];
-    raw_file * const pic_b = desc->pic_b[font];
+    font_char * const fc = get_font_char(desc, c);
+    raw_file * pic_b;
     int error;
 //  fprintf(stderr, "render_one_glyph %d\n", c);
-    if (desc->width[c] != -1) /* already rendered */
+    if (fc->width != -1) /* already rendered */
+        return;
+    if (fc->font == -1) /* can't render without a font face */
         return;
-    if (desc->font[c] == -1) /* can't render without a font face */
+    if (glyphcache_getglyph(desc, c, fc)) /* rendered on a previous run */
         return;
-    glyph_index = desc->glyph_index[c];
+    pic_b = desc->pic_b[fc->font];
+    glyph_index = fc->glyph_index;
     // load glyph into the face's glyph slot
-    error = FT_Load_Glyph(desc->faces[font], glyph_index, font_load_flags);
+    error = FT_Load_Glyph(desc->faces[fc->font], glyph_index, font_load_flags);
     if (error)
       {
         WARNING("FT_Load_Glyph 0x%02x (char 0x%04x) failed.", glyph_index, c);
-        desc->font[c] = -1;
+        fc->font = -1;
         return;
       } /*if*/
-    slot = desc->faces[font]->glyph;
+    slot = desc->faces[fc->font]->glyph;
     // render glyph
     if (slot->format != FT_GLYPH_FORMAT_BITMAP)
       {
@@ -339,7 +987,7 @@ void render_one_glyph(font_desc_t *desc, int c)
         if (error)
           {
             WARNING("FT_Render_Glyph 0x%04x (char 0x%04x) failed.", glyph_index, c);
-            desc->font[c] = -1;
+            fc->font = -1;
             return;
           } /*if*/
       } /*if*/
@@ -348,13 +996,13 @@ void render_one_glyph(font_desc_t *desc, int c)
     if (error)
       {
         WARNING("FT_Get_Glyph 0x%04x (char 0x%04x) failed.", glyph_index, c);
-        desc->font[c] = -1;
+        fc->font = -1;
         return;
       } /*if*/
     if (oglyph->format != FT_GLYPH_FORMAT_BITMAP)
       {
         WARNING("FT_Get_Glyph did not return a bitmap glyph.");
-        desc->font[c] = -1;
+        fc->font = -1;
         return;
       } /*if*/
     glyph = (FT_BitmapGlyph)oglyph;
@@ -364,39 +1012,10 @@ void render_one_glyph(font_desc_t *desc, int c)
       {
         fprintf(stderr, "WARN: glyph too wide!\n");
       } /*if*/
-    // allocate new memory, if needed
-//  fprintf(stderr, "\n%d %d %d\n", pic_b->charwidth, pic_b->charheight, pic_b->current_alloc);
-    off =
-            pic_b->current_count
-        *
-            pic_b->charwidth
-        *
-            pic_b->charheight;
-    if (pic_b->current_count == pic_b->current_alloc)
-      { /* filled allocated space for bmp blocks, need more */
-        const size_t ALLOC_INCR = 32; /* grow in steps of this */
-        const int newsize =
-                pic_b->charwidth
-            *
-                pic_b->charheight
-            *
-                (pic_b->current_alloc + ALLOC_INCR);
-        const int increment =
-                pic_b->charwidth
-            *
-                pic_b->charheight
-            *
-                ALLOC_INCR;
-        pic_b->current_alloc += ALLOC_INCR;
-    //  fprintf(stderr, "\nns = %d inc = %d\n", newsize, increment);
-        pic_b->bmp = realloc(pic_b->bmp, newsize);
-      /* initialize newly-added pixels to transparent: */
-        memset(pic_b->bmp + off, COLIDX_TRANSPARENT, increment);
-      } /*if*/
-    bbuffer = pic_b->bmp + off;
-    paste_bitmap /* copy glyph into next available space in pic_b->bmp */
+    memset(pic_b->cell, COLIDX_TRANSPARENT, pic_b->charwidth * pic_b->charheight);
+    paste_bitmap /* copy glyph into character cell */
       (
-        /*bbuffer =*/ bbuffer,
+        /*bbuffer =*/ pic_b->cell,
         /*bitmap =*/ &glyph->bitmap,
         /*x =*/ pic_b->padding + glyph->left,
         /*y =*/ pic_b->baseline - glyph->top,
@@ -410,17 +1029,13 @@ void render_one_glyph(font_desc_t *desc, int c)
     pen_xa = f266ToInt(slot->advance.x) + 3 * pic_b->padding;
     if (pen_xa > maxw)
         pen_xa = maxw;
-    desc->start[c] = off;
-    width = desc->width[c] = pen_xa;
+    width = fc->width = pen_xa;
     height = pic_b->charheight;
     stride = pic_b->w;
-    add_outline(bbuffer, width, height, stride);
-    if (subtitle_shadow_dx != 0 || subtitle_shadow_dy != 0)
-      {
-        add_shadow(bbuffer, width, height, stride);
-      } /*if*/
+    add_outline_and_shadow(pic_b->cell, width, height, stride);
 //  fprintf(stderr, "fg: outline & shadow t = %lf\n", GetTimer()-t);
-    pic_b->current_count++;
+    fc->image = save_glyph_image(pic_b, width);
+    glyphcache_putglyph(desc, c);
   } /*render_one_glyph*/
 
 static int check_font
@@ -428,9 +1043,7 @@ static int check_font
     font_desc_t *desc,
     float ppem,
     int padding, /* extra space to allow between characters */
-    int pic_idx, /* which face to select from desc->faces */
-    int charset_size, /* length of charset array */
-    const FT_ULong *charset /* character codes to get glyphs for */
+    int pic_idx /* which face to select from desc->faces */
   )
   /* computes various information about the specified font and puts it into desc. */
   {
@@ -454,23 +1067,13 @@ static int check_font
   /* set size */
     if (FT_IS_SCALABLE(face))
       {
-        const int horiz_resolution =
-            widescreen ?
-                54 /* = 72 * (4 / 3) / (16 / 9) */
-            :
-                72;
-        const int vert_resolution =
-            default_video_format == VF_NTSC ?
-                64 /* = 72 * 480 / 540 */
-            : /* default_video_format == VF_PAL ? */
-                77; /* = 72 * 576 / 540 */
         error = FT_Set_Char_Size
           (
             /*face =*/ face,
             /*char_width =*/ 0, /* use height */
             /*char_height =*/ floatTof266(ppem),
-            /*horiz_resolution =*/ horiz_resolution,
-            /*vert_resolution =*/ vert_resolution
+            /*horiz_resolution =*/ horiz_resolution(),
+            /*vert_resolution =*/ vert_resolution()
           );
         if (error)
             WARNING("FT_Set_Char_Size failed.");
@@ -519,28 +1122,6 @@ static int check_font
         desc->charspace = -2 * padding;
     if (!desc->height)
         desc->height = f266ToInt(face->size->metrics.height);
-    for (i = 0; i < charset_size; ++i)
-      {
-        const FT_ULong character = charset[i];
-        FT_UInt glyph_index;
-        desc->font[character] = pic_idx;
-        // get glyph index
-        if (character == 0)
-            glyph_index = 0;
-        else
-          {
-            glyph_index = FT_Get_Char_Index(face, character);
-            if (glyph_index == 0)
-              {
-                WARNING("Glyph for char U+%04X|%c not found.",
-                    (unsigned int)character,
-                    character < ' ' || character > 255 ? '.' : (unsigned int)character);
-                desc->font[character] = -1;
-                continue;
-              } /*if*/
-          } /*if*/
-        desc->glyph_index[character] = glyph_index;
-      } /*for*/
 //  fprintf(stderr, "font height: %lf\n", (double)(face->bbox.yMax - face->bbox.yMin) / (double)face->units_per_EM * ppem);
 //  fprintf(stderr, "font width: %lf\n", (double)(face->bbox.xMax - face->bbox.xMin)/(double)face - >units_per_EM * ppem);
     ymax = (double)face->bbox.yMax / (double)face->units_per_EM * ppem + 1;
@@ -572,11 +1153,10 @@ static int check_font
 //  fprintf(stderr, "font height2: %d\n", height);
     pic_b->baseline = ymax + padding;
     pic_b->padding = padding;
-    pic_b->current_alloc = 0;
-    pic_b->current_count = 0;
     pic_b->w = width;
     pic_b->h = height;
-    pic_b->bmp = NULL;
+    pic_b->cell = malloc(width * height);
+    pic_b->slabs = NULL;
     pic_b->pen = 0;
     return 0;
   } /*check_font*/
@@ -587,8 +1167,6 @@ static int prepare_font
     FT_Face face,
     float ppem,
     int pic_idx, /* which entry in desc->faces to set up */
-    int charset_size, /* length of charset array */
-    const FT_ULong *charset, /* character codes to get glyphs for */
     double thickness /* only to compute inter-character padding */
   )
   /* fills in parts of desc indexed by pic_idx with face and related information. */
@@ -601,71 +1179,23 @@ static int prepare_font
     if (pic_b == NULL)
         return -1;
     desc->pic_b[pic_idx] = pic_b;
-    pic_b->bmp = NULL;
+    pic_b->cell = NULL;
+    pic_b->slabs = NULL;
     memset(pic_b->pal, 0, sizeof pic_b->pal);
     pic_b->pal[COLIDX_FILL] = subtitle_fill_color;
     pic_b->pal[COLIDX_OUTLINE] = subtitle_outline_color;
     pic_b->pal[COLIDX_SHADOW] = subtitle_shadow_color;
 //  ttime = GetTimer();
-    err = check_font(desc, ppem, padding, pic_idx, charset_size, charset);
+    err = check_font(desc, ppem, padding, pic_idx);
 //  ttime = GetTimer() - ttime;
 //  printf("render:   %7lf us\n", ttime);
     if (err)
         return -1;
 //  fprintf(stderr, "fg: render t = %lf\n", GetTimer() - t);
-    pic_b->bmp = NULL;
 //  fprintf(stderr, "fg: w = %d, h = %d\n", pic_b->w, pic_b->h);
     return 0;
   } /*prepare_font*/
 
-static int prepare_charset_unicode
-  (
-    FT_Face face,
-    FT_ULong *charset
-  )
-  /* fills in charset with all the character codes for which glyphs are defined in the font. */
-  {
-#ifdef HAVE_FREETYPE21
-    FT_ULong charcode;
-#else
-    int j;
-#endif
-    FT_UInt gindex;
-    int i;
-    if (face->charmap == NULL || face->charmap->encoding != FT_ENCODING_UNICODE)
-      {
-        WARNING("Unicode charmap not available for this font. Very bad!");
-        return -1;
-      } /*if*/
-#ifdef HAVE_FREETYPE21
-    i = 0;
-    charcode = FT_Get_First_Char(face, &gindex);
-    while (gindex != 0)
-      {
-        if (charcode < 65536 && charcode >= 33) // sanity check
-          {
-            charset[i] = charcode;
-            i++;
-          } /*if*/
-        charcode = FT_Get_Next_Char(face, charcode, &gindex);
-      } /*while*/
-#else
-  // for FT < 2.1 we have to use brute force enumeration
-    i = 0;
-    for (j = 33; j < 65536; j++)
-      {
-        gindex = FT_Get_Char_Index(face, j);
-        if (gindex > 0)
-          {
-            charset[i] = j;
-            i++;
-          } /*if*/
-      } /*for*/
-#endif
-    fprintf(stderr, "INFO: Unicode font: %d glyphs.\n", i);
-    return i;
-  } /*prepare_charset_unicode*/
-
 static font_desc_t* init_font_desc()
   /* allocates and initializes a new font_desc_t structure. */
   {
@@ -682,8 +1212,9 @@ static font_desc_t* init_font_desc()
     desc->height = 0;
     desc->max_width = 0;
     desc->max_height = 0;
-    for (i = 0; i < 65536; i++)
-        desc->start[i] = desc->width[i] = desc->font[i] = -1; /* indicate no glyph images cached */
+    desc->substchar = ' ';
+    for (i = 0; i < FONT_MAXCHAR / FONT_CHARBLOCK; i++)
+        desc->chars[i] = NULL; /* no characters looked up yet */
     for (i = 0; i < 16; i++)
         desc->pic_b[i] = NULL;
     return desc;
@@ -695,14 +1226,21 @@ static void free_font_desc(font_desc_t *desc)
     int i;
     if (!desc)
         return; /* nothing to do */
+    glyphcache_close(desc);
     for (i = 0; i < 16; i++)
       {
         if (desc->pic_b[i])
           {
-            free(desc->pic_b[i]->bmp);
+            free(desc->pic_b[i]->cell);
+            free_glyph_images(desc->pic_b[i]);
           } /*if*/
         free(desc->pic_b[i]);
       } /*for*/
+    for (i = 0; i < FONT_MAXCHAR / FONT_CHARBLOCK; i++)
+      {
+        free(desc->chars[i]);
+      } /*for*/
+    free(desc->kerns);
     for (i = 0; i < desc->face_cnt; i++)
       {
         FT_Done_Face(desc->faces[i]);
@@ -710,10 +1248,12 @@ static void free_font_desc(font_desc_t *desc)
     free(desc);
   } /*free_font_desc*/
 
-static void load_sub_face(const char *name, FT_Face *face)
-  /* loads the font with the specified name and returns it in face. */
+static char *load_sub_face(const char *name, FT_Face *face)
+  /* loads the font with the specified name and returns it in face. Returns the
+    name of the font file actually loaded, which the caller must free. */
   {
     int err = -1;
+    char *fontfile = NULL;
 #if HAVE_FONTCONFIG
     FcPattern *searchpattern, *foundpattern;
     FcResult result = FcResultMatch;
@@ -728,18 +1268,26 @@ static void load_sub_face(const char *name, FT_Face *face)
       /* fixme: would be good to try interpreting relative path as relative to
         XML control file */
         err = FT_New_Face(library, name, 0, face);
-        if (err == 0 || strchr(name, '/') != NULL)
+        if (err == 0)
+          {
+            fontfile = strdup(name);
+            break;
+          } /*if*/
+        if (strchr(name, '/') != NULL)
             break;
 #if HAVE_FONTCONFIG
         if (strchr(name, '.') != NULL) /* only try this if it looks like a file name */
 #endif /*HAVE_FONTCONFIG*/
           {
           /* see if it can be found in config_path */
-            const char * const fontpath = get_config_path(name);
+            char * const fontpath = get_config_path(name);
             err = FT_New_Face(library, fontpath, 0, face);
-            free((void *)fontpath);
             if (err == 0)
+              {
+                fontfile = fontpath;
                 break;
+              } /*if*/
+            free(fontpath);
           } /*if*/
 #if HAVE_FONTCONFIG
     /* adaptation of patch by Nicolas George: add support for fontconfig. */
@@ -774,7 +1322,10 @@ static void load_sub_face(const char *name, FT_Face *face)
         fprintf(stderr, "INFO: font name \"%s\" matches font file %s\n", name, foundfilename);
         err = FT_New_Face(library, (const char *)foundfilename, 0, face);
         if (err == 0)
+          {
+            fontfile = strdup((const char *)foundfilename);
             break;
+          } /*if*/
 #endif /*HAVE_FONTCONFIG*/
       }
     while (false);
@@ -799,27 +1350,40 @@ static void load_sub_face(const char *name, FT_Face *face)
           );
         exit(1);
       } /*if*/
+    return fontfile;
   } /*load_sub_face*/
 
 int kerning(font_desc_t *desc, int prevc, int c)
   /* returns the amount of kerning to apply between character c and previous character prevc. */
   {
     FT_Vector kern;
+    const font_char *prevfc, *fc;
     if (prevc < 0 || c < 0) /* need 2 characters to kern */
         return 0;
-    if (desc->font[prevc] != desc->font[c]) /* font change => don't kern */
+    prevfc = get_font_char(desc, prevc);
+    fc = get_font_char(desc, c);
+    if (prevfc->font != fc->font) /* font change => don't kern */
         return 0;
-    if (desc->font[prevc] == -1 /* <=> desc->font[c] == -1 */)
+    if (prevfc->font == -1 /* <=> fc->font == -1 */)
         return 0;
+    if (desc->nrkerns != 0)
+      {
+        const kern_entry * const entry = find_kern(desc, prevfc->glyph_index, fc->glyph_index);
+        if (entry->used)
+            return entry->kern;
+      } /*if*/
     FT_Get_Kerning
       (
-        /*face =*/ desc->faces[desc->font[c]],
-        /*left_glyph =*/ desc->glyph_index[prevc],
-        /*right_glyph =*/ desc->glyph_index[c],
+        /*face =*/ desc->faces[fc->font],
+        /*left_glyph =*/ prevfc->glyph_index,
+        /*right_glyph =*/ fc->glyph_index,
         /*kern_mode =*/ FT_KERNING_DEFAULT,
         /*akerning =*/ &kern
       );
 //  fprintf(stderr, "kern: %c %c %d\n", prevc, c, f266ToInt(kern.x));
+    add_kern(desc, prevfc->glyph_index, fc->glyph_index, f266ToInt(kern.x));
+    if (desc->glyphcache != NULL)
+        desc->glyphcache->nrnewkerns++;
     return f266ToInt(kern.x);
   } /*kerning*/
 
@@ -835,10 +1399,9 @@ static font_desc_t * read_font_desc_ft
   {
     font_desc_t *desc;
     FT_Face face;
-    FT_ULong my_charset[MAX_CHARSET_SIZE]; /* characters we want to render; Unicode */
+    char *fontfile;
     int err;
-    int charset_size;
-    int i, j;
+    int j;
     float movie_size;
     float subtitle_font_ppem;
     switch (subtitle_autoscale)
@@ -867,15 +1430,17 @@ static font_desc_t * read_font_desc_ft
         return NULL;
 //  t = GetTimer();
   /* generate the subtitle font */
-    load_sub_face(fname, &face);
+    fontfile = load_sub_face(fname, &face);
     desc->face_cnt++; /* will always be 1, since I just created desc */
-    charset_size = prepare_charset_unicode(face, my_charset);
-    if (charset_size < 0)
+    if (face->charmap == NULL || face->charmap->encoding != FT_ENCODING_UNICODE)
       {
-        fprintf(stderr, "ERR:  subtitle font: prepare_charset_unicode failed.\n");
+        WARNING("Unicode charmap not available for this font. Very bad!");
+        fprintf(stderr, "ERR:  subtitle font: no Unicode charmap.\n");
+        free(fontfile);
         free_font_desc(desc);
         return NULL;
       } /*if*/
+    fprintf(stderr, "INFO: Unicode font: %ld glyphs.\n", (long)face->num_glyphs);
 //  fprintf(stderr, "fg: prepare t = %lf\n", GetTimer() - t);
     err = prepare_font
       (
@@ -883,34 +1448,25 @@ static font_desc_t * read_font_desc_ft
         /*face =*/ face,
         /*ppem =*/ subtitle_font_ppem,
         /*pic_idx =*/ desc->face_cnt - 1,
-        /*charset_size =*/ charset_size,
-        /*charset =*/ my_charset,
         /*thickness =*/ subtitle_font_thickness
       );
     if (err)
       {
         fprintf(stderr, "ERR:  Cannot prepare subtitle font.\n");
+        free(fontfile);
         free_font_desc(desc);
         return NULL;
       } /*if*/
-    // final cleanup
-    desc->font[' '] = -1;
-    desc->width[' '] = desc->spacewidth;
+    glyphcache_open(desc, fontfile, subtitle_font_ppem, subtitle_font_thickness);
+    free(fontfile);
+    // pick a character to show in place of ones not in the font
     j = '_';
-    if (desc->font[j] < 0)
+    if (FT_Get_Char_Index(face, j) == 0)
         j = '?';
-    if (desc->font[j] < 0)
+    if (FT_Get_Char_Index(face, j) == 0)
         j = ' ';
     render_one_glyph(desc, j);
-    for (i = 0; i < 65536; i++)
-      {
-        if (i != ' ' && desc->font[i] < 0)
-          {
-            desc->start[i] = desc->start[j];
-            desc->width[i] = desc->width[j];
-            desc->font[i] = desc->font[j];
-          } /*if*/
-      } /*for*/
+    desc->substchar = j;
     return desc;
   } /*read_font_desc_ft*/
 
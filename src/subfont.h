@@ -11,37 +11,62 @@
 #include FT_FREETYPE_H
 #endif
 
-typedef struct /* a bitmap for caching glyph images */
+typedef struct /* a rendered glyph, trimmed to the part of its character cell containing pixels */
+  {
+    short left, top; /* position of image within character cell */
+    short width, height; /* dimensions of image */
+    unsigned char pixels[]; /* [height][width] 8-bit-per-pixel indexes into raw_file.pal */
+  } glyph_image;
+
+struct glyph_slab; /* opaque, private to subfont.c */
+
+typedef struct /* rendering information and glyph images for a font face */
   {
-    unsigned char *bmp; /* 8-bit-per-pixel indexed image bitmap accumulated here */
     colorspec pal[256]; /* colour palette */
-    int w, h;
+    int w, h; /* dimensions of a character cell */
 #ifdef HAVE_FREETYPE
     int charwidth, charheight;
     int pen, baseline, padding;
-    int current_count; /* multiplied by charwidth * charheight = used size of bmp */
-    int current_alloc; /* multiplied by charwidth * charheight = allocated size of bmp */
+    unsigned char *cell; /* charwidth * charheight area in which each glyph is rendered */
+    struct glyph_slab *slabs; /* where glyph_images are kept, never moved once allocated */
 #endif
   } raw_file;
 
+typedef struct /* what to render for a particular Unicode character */
+  {
+    short font; /* index into faces array, which FT_Face to use for rendering this character */
+    short width; /* width in pixels of image for this character */
+    const glyph_image *image; /* rendered image for this character, NULL if none yet */
+#ifdef HAVE_FREETYPE
+    FT_UInt glyph_index; /* glyph index for this character in the font */
+#endif
+  } font_char;
+
+#define FONT_MAXCHAR 0x110000 /* characters are Unicode character codes less than this */
+#define FONT_CHARBLOCK 256 /* font_char entries are allocated in blocks of this many */
+
+struct glyphcache; /* opaque, private to subfont.c */
+typedef struct kern_entry kern_entry; /* opaque, private to subfont.c */
+
 typedef struct
   {
     int spacewidth;
     int charspace; /* extra inter-character spacing, may be negative */
     int height;
     raw_file* pic_b[16]; /* luma for glyph images, 8 bits per pixel */
-    short font[65536];
-      /* index into faces array, which FT_Face to use for rendering this Unicode character */
-    int start[65536];   // short is not enough for unicode fonts
-      /* horizontal offset into bmp at which to find image for each Unicode character */
-    short width[65536]; /* width in pixels of image for each Unicode character */
+    font_char *chars[FONT_MAXCHAR / FONT_CHARBLOCK];
+      /* information for each Unicode character, blocks only allocated as characters are
+        used, and entries only looked up in the font the first time they are used */
+    int substchar; /* character to show in place of ones not in the font */
 
 #ifdef HAVE_FREETYPE
     int face_cnt; /* how many entries in faces are used (actually always only 1) */
     FT_Face faces[16]; /* I suppose this is to allow getting different ranges of characters from different fonts */
-    FT_UInt glyph_index[65536]; /* glyph index indexed by Unicode character code */
 
     int max_width, max_height;
+    kern_entry *kerns; /* hash table [allockerns] of kerning values already looked up */
+    int nrkerns, allockerns;
+    struct glyphcache *glyphcache; /* on-disk cache of rendered glyphs, if enabled */
 #endif
   } font_desc_t;
 
@@ -52,6 +77,7 @@ extern font_desc_t* vo_font;
 int init_freetype();
 int done_freetype();
 
+font_char *get_font_char(font_desc_t *desc, int c);
 void render_one_glyph(font_desc_t *desc, int c);
 int kerning(font_desc_t *desc, int prevc, int c);
 
@@ -59,6 +85,7 @@ void load_font_ft();
 
 #else
 
+static font_char *get_font_char(font_desc_t *desc, int c) { return NULL; }
 static void render_one_glyph(font_desc_t *desc, int c) {}
 static int kerning(font_desc_t *desc, int prevc, int c) { return 0; }
 
@@ -38,27 +38,51 @@ static void store_init()
     subo=0;
 }
 
-static int bitmask[9]={0,1,3,7,15,31,63,127,255};
 static void store_bits(unsigned int val,int bits)
-{
-    if( subo>SUB_BUFFER_MAX )
+  /* appends the low-order bits of val to the bitstream in sub, most significant first. */
+  {
+    unsigned int used; /* bits already occupied in current byte, plus ones to add */
+    uint32_t window;
+    if (subo > SUB_BUFFER_MAX)
         return;
-    while(bits) {
-        if( bits>remainbit ) {
-            sub[subo++]|=(val>>(bits-remainbit))&bitmask[remainbit];
-            bits-=remainbit;
-            remainbit=8;
-        } else if( bits==remainbit ) {
-            sub[subo++]|=val&bitmask[remainbit];
-            remainbit=8;
-            return;
-        } else {
-            sub[subo]|=(val&bitmask[bits])<<(remainbit-bits);
-            remainbit-=bits;
-            return;
-        }
-    }
-}
+    if (bits > 24)
+      {
+      /* won't necessarily fit in window */
+        store_bits(val >> 16, bits - 16);
+        bits = 16;
+      } /*if*/
+    used = 8 - remainbit + bits;
+  /* line up the bits in a big-endian window starting at the current byte */
+    window = (val & ((1U << bits) - 1)) << (32 - used);
+    sub[subo] |= window >> 24;
+    if (used > 8)
+        sub[subo + 1] = window >> 16;
+    if (used > 16)
+        sub[subo + 2] = window >> 8;
+    if (used > 24)
+        sub[subo + 3] = window;
+    subo += used / 8;
+    remainbit = 8 - used % 8;
+  } /*store_bits*/
+
+static int runlength(const unsigned char *p, int n)
+  /* returns the number of consecutive pixels starting at p, up to n, that have
+    the same value as p[0]. Compares a whole word of pixels at a time. */
+  {
+    const uint64_t pattern = p[0] * UINT64_C(0x0101010101010101);
+    int i = 1;
+    while (i + 8 <= n)
+      {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        if (w != pattern)
+            break;
+        i += 8;
+      } /*while*/
+    while (i < n && p[i] == p[0])
+        i++;
+    return i;
+  } /*runlength*/
 
 static void store_2bit(int val)
 {
@@ -174,9 +198,8 @@ int svcd_encode(stinfo *s)
             if ((c = s->fimg[y*s->xd+x]) != 0) store_2bit(c);
             else
             {
-                c = 1;
-                while (((++x)<s->xd)  &&  (!s->fimg[y*s->xd+x])) c++;
-                x--;
+                c = runlength(s->fimg + y * s->xd + x, s->xd - x);
+                x += c - 1;
                 while (c>4)
                 {
                     store_nibble(3);
@@ -234,8 +257,8 @@ int cvd_encode(stinfo *s)
     for(x = 0; x < s->xd;)
         {
             d = s->fimg[y * s->xd + x];
-            c = 1;
-            while (((++x) < s->xd)  &&  (s->fimg[y * s->xd + x] == d) ) c++;
+            c = runlength(s->fimg + y * s->xd + x, s->xd - x);
+            x += c;
             if(x == s->xd)
             {
                 store_nibble(0);
@@ -394,76 +417,56 @@ static void do_rle(int count, int color)
     if(count >= 64)     // 64 - 255
     {
     /* 64-255, 16 bits, 0 0 0 0  0 0 n n  n n n n  n n c c */
-    store_nibble(0);
-    store_nibble( (a & 0xf00) >> 8);
-    store_nibble( (a & 0xf0) >> 4);
-    store_nibble( a & 0xf);
+    store_bits(a, 16);
     }
     else if(count >= 16)    // 16 - 63
     {
     /* 16 - 63, 12 bits, 0 0 0 0  n n n n  n n c c */
-    store_nibble( 0);
-    store_nibble( (a & 0xf0) >> 4);
-    store_nibble( a & 0xf);
+    store_bits(a, 12);
     }
     else if(count >= 4)     // 4 - 15
     {
     /* 4-15, 8 bits, 0 0 n n  n n c c */
-    store_nibble( (a & 0xf0) >> 4);
-    store_nibble( a & 0xf);
+    store_bits(a, 8);
     }
     else            // 1 - 3
     {
     /* 1-3, 4 bits, n n c c */
-    store_nibble( a & 0xf );
+    store_bits(a, 4);
     }
 } /* end function do_rle */
 
 
 static void dvd_encode_row(int y,int xd,unsigned char *icptr)
 {
-    int new_pos, x;
+    int x;
     int osubo=subo;
 
-    new_pos = 0;
     icptr+=y*xd;
-    for(x = 0; x < xd-1; x++)
+    for(x = 0; x < xd;)
     {
-        /* get color from x,y */
-
-        if(icptr[x + 1] != icptr[x])
+        const int color = icptr[x];
+        int count = runlength(icptr + x, xd - x);
+        x += count;
+        if( x < xd )
         {
-            int count=x+1-new_pos;
             while(count>255) {
-                do_rle(255,icptr[x]);
+                do_rle(255,color);
                 count-=255;
             }
-            if( count )
-                do_rle(count,icptr[x]);
-            new_pos = x + 1;
+            do_rle(count,color);
         }
-    } /* end for x */
-
-    /*
-      One special case,
-      encoding a count of zero using the 16-bit format,
-      indicates the same pixel value until the end of the line.
-    */
-
-    if( xd != new_pos )
-    {
-        int count=xd-new_pos;
-
-        if( count < 64 )
-            do_rle(count,icptr[new_pos]);
-        else {
+        /*
+          One special case,
+          encoding a count of zero using the 16-bit format,
+          indicates the same pixel value until the end of the line.
+        */
+        else if( count < 64 )
+            do_rle(count,color);
+        else
             /* send same colors to end of line */
-            store_nibble(0);
-            store_nibble(0);
-            store_nibble(0);
-            store_nibble(icptr[new_pos]);
-        }
-    }
+            store_bits(color, 16);
+    } /* end for x */
 
     /*
       If, at the end of a line, the bit count is not a multiple of 8, four fill bits of 0 are added.
@@ -519,12 +522,19 @@ int dvd_encode(stinfo *s)
 
     /* copy image data to sub */
     offset0=subo;
-    for( y=0; y<s->yd; y+=2 ) /* top field */
-        dvd_encode_row(y,s->xd,icptr);
+    if( spucache_getpixels(s,sub+offset0,&a,&offset1) ) {
+        /* same as an identical subtitle encoded earlier */
+        subo+=a;
+        offset1+=offset0;
+    } else {
+        for( y=0; y<s->yd; y+=2 ) /* top field */
+            dvd_encode_row(y,s->xd,icptr);
 
-    offset1=subo;
-    for( y=1; y<s->yd; y+=2 ) /* bottom field */
-        dvd_encode_row(y,s->xd,icptr);
+        offset1=subo;
+        for( y=1; y<s->yd; y+=2 ) /* bottom field */
+            dvd_encode_row(y,s->xd,icptr);
+        spucache_putpixels(s,sub+offset0,subo-offset0,offset1-offset0);
+    }
 
     /* start first command block */
 /*
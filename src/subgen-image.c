@@ -27,6 +27,9 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <math.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #if defined(HAVE_MAGICK) || defined(HAVE_GMAGICK)
 #include <stdarg.h>
@@ -46,6 +49,12 @@
 bool text_forceit = false;     /* Forcing of the subtitles */
 sub_data *textsub_subdata;
 
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t renderlock = PTHREAD_MUTEX_INITIALIZER;
+  /* the text renderer keeps its state in globals, so subtitles being processed
+    on different threads must take turns at it */
+#endif
+
 static void constructblankpic(pict *p,int w,int h)
   /* allocates and fills in p with an image consisting entirely of transparent pixels */
 {
@@ -95,28 +104,64 @@ static void scanpict(stinfo *s, pict *p)
           /* just make sure all the colours are in the colour table */
   } /*scanpict*/
 
+/* while an image is being read, pict.colorhash indexes its colour table, so
+  putpixel doesn't have to search the whole table for every pixel. Entries are
+  1 + index into pal, or 0 for an empty slot. */
+#define COLORHASHSIZE 512 /* power of 2, at least twice the max nr of colours */
+
+static uint32_t packcolor(const colorspec *c)
+  {
+    return (uint32_t)c->r << 24 | (uint32_t)c->g << 16 | (uint32_t)c->b << 8 | c->a;
+  } /*packcolor*/
+
+static void colorhash_reset(pict *p)
+  /* allocates and clears the colour index in preparation for reading pixels into p. */
+  {
+    if (!p->colorhash)
+        p->colorhash = malloc(COLORHASHSIZE * sizeof(short));
+    memset(p->colorhash, 0, COLORHASHSIZE * sizeof(short));
+    p->lastcolorindex = -1;
+  } /*colorhash_reset*/
+
+static void colorhash_free(pict *p)
+  /* disposes of the colour index once the image has been read. */
+  {
+    free(p->colorhash);
+    p->colorhash = NULL;
+  } /*colorhash_free*/
+
 static void putpixel(pict *p, int x, const colorspec *c)
   /* stores another pixel into pict p at offset x with colour c. Adds a new
     entry into the colour table if not already present and there's room. */
   {
-    int i;
-    colorspec ct;
+    uint32_t key;
+    unsigned int h;
     if (!c->a && (c->r || c->g || c->b))
       {
       /* all transparent pixels look alike to me */
-        ct.a = 0;
-        ct.r = 0;
-        ct.g = 0;
-        ct.b = 0;
-        c = &ct;
+        key = 0;
+      }
+    else
+        key = packcolor(c);
+    if (key == p->lastcolor && p->lastcolorindex >= 0)
+      {
+      /* same as previous pixel, very common */
+        p->img[x] = p->lastcolorindex;
+        return;
       } /*if*/
-    for (i = 0; i < p->numpal; i++)
-        if (!memcmp(&p->pal[i], c, sizeof(colorspec)))
+    h = ((key * 2654435761U) >> 23) & (COLORHASHSIZE - 1);
+    while (p->colorhash[h])
+      {
+        if (packcolor(&p->pal[p->colorhash[h] - 1]) == key)
           {
           /* matches existing palette entry */
-            p->img[x] = i;
+            p->img[x] = p->colorhash[h] - 1;
+            p->lastcolor = key;
+            p->lastcolorindex = p->colorhash[h] - 1;
             return;
-          } /*if; for*/
+          } /*if*/
+        h = (h + 1) & (COLORHASHSIZE - 1);
+      } /*while*/
     if (p->numpal == 256)
       {
       /* too many colours */
@@ -126,13 +171,20 @@ static void putpixel(pict *p, int x, const colorspec *c)
   /* allocate new palette entry */
     p->img[x] = p->numpal;
 /*  fprintf(stderr, "CREATING COLOR %d,%d,%d %d\n", c->r, c->g, c->b, c->a); */
-    p->pal[p->numpal++] = *c;
+    p->pal[p->numpal].r = key >> 24;
+    p->pal[p->numpal].g = key >> 16;
+    p->pal[p->numpal].b = key >> 8;
+    p->pal[p->numpal].a = key;
+    p->colorhash[h] = ++p->numpal;
+    p->lastcolor = key;
+    p->lastcolorindex = p->numpal - 1;
   } /*putpixel*/
 
 static void createimage(pict *s, int w, int h)
   /* allocates memory for pixels in s with dimensions w and h. */
   {
     s->numpal = 0;
+    colorhash_reset(s);
   /* ensure allocated dimensions are even */
     s->width = w + (w & 1);
     s->height = h + (h & 1);
@@ -232,9 +284,11 @@ static int read_png(pict *s)
     FILE *fp;
     png_struct *ps;
     png_info *pi;
-    png_byte **rowp;
+    png_byte **rowp,*pixels;
     png_uint_32 width,height;
+    png_size_t rowbytes;
     int bit_depth,color_type,channels,x,y;
+    bool indexed;
 
     fp=fopen(s->fname,"rb");
     if( !fp ) {
@@ -263,49 +317,114 @@ static int read_png(pict *s)
     png_init_io(ps,fp);
     png_set_sig_bytes(ps,8);
 
-    png_read_png(ps,pi,PNG_TRANSFORM_PACKING|PNG_TRANSFORM_STRIP_16|PNG_TRANSFORM_EXPAND,NULL);
-    rowp=png_get_rows(ps,pi);
+    png_read_info(ps,pi);
     png_get_IHDR(ps,pi,&width,&height,&bit_depth,&color_type,NULL,NULL,NULL);
-    // format is now RGB[A] or G[A]
-    channels=png_get_channels(ps,pi);
-    fclose(fp);
-    if(color_type&PNG_COLOR_MASK_COLOR)
-        channels-=3;
-    else
-        channels--;
-    if(color_type&PNG_COLOR_MASK_ALPHA)
-        channels--;
-    assert(bit_depth==8); // 8bpp, not 1, 2, 4, or 16
-    assert(!(color_type&PNG_COLOR_MASK_PALETTE)); // not a palette
     if( width>MAXX || height>MAXY ) {
         fprintf(stderr,"ERR:  PNG %s is too big: %lux%lu\n",s->fname,width,height);
         png_destroy_read_struct(&ps,&pi,NULL);
+        fclose(fp);
         return -1;
     }
+    // palette and plain greyscale images have at most 256 different pixel values,
+    // so these can be mapped to colours directly instead of expanding every pixel
+    indexed=color_type==PNG_COLOR_TYPE_PALETTE || (color_type==PNG_COLOR_TYPE_GRAY && bit_depth<=8);
+    if( !indexed ) {
+        png_set_expand(ps);
+        png_set_strip_16(ps);
+    }
+    png_set_packing(ps);
+    png_set_interlace_handling(ps); // as png_read_png does
+    png_read_update_info(ps,pi);
+    rowbytes=png_get_rowbytes(ps,pi);
+    pixels=malloc(rowbytes*height);
+    rowp=malloc(height*sizeof(png_byte *));
+    for( y=0; y<height; y++ )
+        rowp[y]=pixels+y*rowbytes;
+    png_read_image(ps,rowp);
+    png_read_end(ps,NULL);
+    fclose(fp);
     createimage(s,width,height);
-    for( y=0; y<height; y++ ) {
-        unsigned char *d=rowp[y];
-        for( x=0; x<width; x++ ) {
-            colorspec p;
-            if(color_type&PNG_COLOR_MASK_COLOR) {
-                p.r=*d++;
-                p.g=*d++;
-                p.b=*d++;
-            } else {
-                p.r=*d++;
-                p.g=p.r;
-                p.b=p.r;
+    if( indexed ) {
+        colorspec vals[256]; // colour for each pixel value
+        int map[256]; // index into s->pal for each pixel value, -1 if not seen yet
+        png_byte *trans_alpha=NULL;
+        png_color_16 *trans_color=NULL;
+        int num_trans=0;
+
+        png_get_tRNS(ps,pi,&trans_alpha,&num_trans,&trans_color);
+        if( color_type==PNG_COLOR_TYPE_PALETTE ) {
+            png_color *plte;
+            int num_palette;
+
+            if( !png_get_PLTE(ps,pi,&plte,&num_palette) )
+                num_palette=0;
+            memset(vals,0,sizeof(vals));
+            for( x=0; x<num_palette; x++ ) {
+                vals[x].r=plte[x].red;
+                vals[x].g=plte[x].green;
+                vals[x].b=plte[x].blue;
+                vals[x].a=x<num_trans ? trans_alpha[x] : 255;
+            }
+        } else {
+            const int maxval=(1<<bit_depth)-1;
+            for( x=0; x<=maxval; x++ ) {
+                vals[x].r=x*255/maxval; // same scaling as png_set_expand
+                vals[x].g=vals[x].r;
+                vals[x].b=vals[x].r;
+                vals[x].a=trans_color && num_trans && x==trans_color->gray ? 0 : 255;
+            }
+        }
+        for( x=0; x<256; x++ )
+            map[x]=-1;
+        for( y=0; y<height; y++ ) {
+            const unsigned char *d=rowp[y];
+            unsigned char *o=s->img+y*s->width;
+            for( x=0; x<width; x++ ) {
+                const int c=d[x];
+                if( map[c]<0 ) {
+                    // first pixel with this value, let putpixel allocate its entry
+                    putpixel(s,y*s->width+x,&vals[c]);
+                    map[c]=o[x];
+                } else
+                    o[x]=map[c];
+            }
+        }
+    } else {
+        png_get_IHDR(ps,pi,&width,&height,&bit_depth,&color_type,NULL,NULL,NULL);
+        // format is now RGB[A] or G[A]
+        channels=png_get_channels(ps,pi);
+        if(color_type&PNG_COLOR_MASK_COLOR)
+            channels-=3;
+        else
+            channels--;
+        if(color_type&PNG_COLOR_MASK_ALPHA)
+            channels--;
+        assert(bit_depth==8); // 8bpp, not 1, 2, 4, or 16
+        assert(!(color_type&PNG_COLOR_MASK_PALETTE)); // not a palette
+        for( y=0; y<height; y++ ) {
+            unsigned char *d=rowp[y];
+            for( x=0; x<width; x++ ) {
+                colorspec p;
+                if(color_type&PNG_COLOR_MASK_COLOR) {
+                    p.r=*d++;
+                    p.g=*d++;
+                    p.b=*d++;
+                } else {
+                    p.r=*d++;
+                    p.g=p.r;
+                    p.b=p.r;
+                }
+                if( color_type&PNG_COLOR_MASK_ALPHA )
+                    p.a=*d++;
+                else
+                    p.a=255;
+                d+=channels;
+                putpixel(s,y*s->width+x,&p);
             }
-            if( color_type&PNG_COLOR_MASK_ALPHA )
-                p.a=*d++;
-            else
-                p.a=255;
-            d+=channels;
-            putpixel(s,y*s->width+x,&p);
         }
-        // free(rowp[y]);
     }
-    // free(rowp);
+    free(rowp);
+    free(pixels);
     png_destroy_read_struct(&ps,&pi,NULL);
     fprintf(stderr,"INFO: PNG had %d colors\n",s->numpal);
 
@@ -313,23 +432,191 @@ static int read_png(pict *s)
 }
 #endif
 
+// ****************************************************
+//
+// Cache of decoded image files, so the same highlight/select image used in
+// many subpictures only gets decoded once
+
+#define IMAGECACHE_MAX (64 * 1024 * 1024) /* max total bytes of cached pixels */
+
+typedef struct imagecache_entry { /* a decoded image file */
+    struct imagecache_entry *next; /* next less-recently used entry */
+    char *fname; /* file it was read from */
+    time_t mtime; /* last-modification time of file when read */
+    off_t size; /* size of file when read */
+    int width, height, numpal;
+    colorspec pal[256];
+    unsigned char *img; /* pixels, width * height */
+} imagecache_entry;
+
+static imagecache_entry *imagecache = 0; /* most-recently used first */
+static size_t imagecache_size = 0; /* total bytes of pixels in imagecache */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t imagecachelock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static imagecache_entry **imagecache_find(const char *fname, const struct stat *st)
+  /* returns a pointer to the link to the cache entry for the specified file, if there
+    is one matching st, else to the null link at the end of the list. Caller must
+    hold imagecachelock. */
+  {
+    imagecache_entry **prev, *e;
+    for (prev = &imagecache; (e = *prev) != 0; prev = &e->next)
+        if
+          (
+                !strcmp(e->fname, fname)
+            &&
+                e->mtime == st->st_mtime
+            &&
+                e->size == st->st_size
+          )
+            break;
+    return prev;
+  } /*imagecache_find*/
+
+static bool imagecache_get(pict *p, const struct stat *st)
+  /* fills in p from a cached copy of the image in p->fname, if there is one
+    matching st. Returns true iff found. */
+  {
+    imagecache_entry **prev, *e;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&imagecachelock);
+#endif
+    prev = imagecache_find(p->fname, st);
+    e = *prev;
+    if (e)
+      {
+      /* move to front of list */
+        *prev = e->next;
+        e->next = imagecache;
+        imagecache = e;
+        p->width = e->width;
+        p->height = e->height;
+        p->numpal = e->numpal;
+        memcpy(p->pal, e->pal, e->numpal * sizeof(colorspec));
+        p->img = malloc(e->width * e->height);
+        memcpy(p->img, e->img, e->width * e->height);
+      } /*if*/
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&imagecachelock);
+#endif
+    if (e)
+        fprintf(stderr, "INFO: Picture %s already read, had %d colors\n", p->fname, p->numpal);
+    return e != 0;
+  } /*imagecache_get*/
+
+static void imagecache_free(imagecache_entry *e)
+  /* disposes of a cache entry no longer in the list. Caller must hold imagecachelock. */
+  {
+    imagecache_size -= e->width * e->height;
+    free(e->fname);
+    free(e->img);
+    free(e);
+  } /*imagecache_free*/
+
+static void imagecache_put(const pict *p, const struct stat *st)
+  /* remembers a copy of the image just read into p from the file described
+    by st, discarding least-recently-used entries to stay within IMAGECACHE_MAX. */
+  {
+    const size_t size = p->width * p->height;
+    imagecache_entry *e, **prev;
+    if (size > IMAGECACHE_MAX / 4)
+        return; /* not worth evicting everything else for */
+    e = malloc(sizeof(imagecache_entry));
+    e->fname = strdup(p->fname);
+    e->mtime = st->st_mtime;
+    e->size = st->st_size;
+    e->width = p->width;
+    e->height = p->height;
+    e->numpal = p->numpal;
+    memcpy(e->pal, p->pal, p->numpal * sizeof(colorspec));
+    e->img = malloc(size);
+    memcpy(e->img, p->img, size);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&imagecachelock);
+#endif
+    imagecache_size += size;
+    if (*imagecache_find(p->fname, st))
+      /* another thread got there first */
+        imagecache_free(e);
+    else
+      {
+        e->next = imagecache;
+        imagecache = e;
+      } /*if*/
+    while (imagecache_size > IMAGECACHE_MAX)
+      {
+      /* drop least-recently used entry */
+        for (prev = &imagecache; (*prev)->next; prev = &(*prev)->next)
+          /* find end of list */;
+        e = *prev;
+        *prev = 0;
+        imagecache_free(e);
+      } /*while*/
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&imagecachelock);
+#endif
+  } /*imagecache_put*/
+
+static void imagecache_flush(void)
+  /* discards all cached images. */
+  {
+    while (imagecache)
+      {
+        imagecache_entry * const e = imagecache;
+        imagecache = e->next;
+        imagecache_free(e);
+      } /*while*/
+  } /*imagecache_flush*/
+
 static int read_frame(pict *s)
-  /* fills in s from textsub_image_buffer. */
+  /* fills in s from the area of textsub_image_buffer last rendered into. */
   {
-    int x, y;
-    createimage(s, movie_width, movie_height);
-    for (y = 0; y < movie_height; y++)
+    int x, y, i;
+    const int w = textsub_image_x1 - textsub_image_x0, h = textsub_image_y1 - textsub_image_y0;
+    int map[4]; /* index into s->pal for each entry in textsub_image_pal, -1 if not seen yet */
+    bool seedtransparent =
+            textsub_image_x0 > 0
+        ||
+            textsub_image_y0 > 0
+        ||
+            (movie_width & 1) != 0
+        ||
+            (movie_height & 1) != 0;
+      /* whether converting the whole frame would have come across a transparent
+        pixel before this one, in which case it must get its palette entry first
+        so the palette order stays the same */
+    for (i = 0; i < 4; i++)
+        map[i] = -1;
+    createimage(s, w, h);
+    for (y = 0; y < h; y++)
       {
-          const unsigned char * d = textsub_image_buffer + y * movie_width * 4;
-          for (x = 0; x < movie_width; x++)
+          const unsigned char * d =
+              textsub_image_buffer + (y + textsub_image_y0) * movie_width + textsub_image_x0;
+          for (x = 0; x < w; x++)
             {
-              colorspec p;
-              p.r = *d++;
-              p.g = *d++;
-              p.b = *d++;
-              p.a = *d++;
-              putpixel(s, y * s->width + x, &p);
+              const int c = *d++, p = y * s->width + x;
+              if (seedtransparent)
+                {
+                  seedtransparent = false;
+                  if (map[0] < 0)
+                    {
+                    /* pixel gets overwritten just below */
+                      putpixel(s, p, &textsub_image_pal[0]);
+                      map[0] = s->img[p];
+                    } /*if*/
+                } /*if*/
+              if (map[c] < 0)
+                {
+                /* first pixel in this colour, let putpixel allocate its entry */
+                  putpixel(s, p, &textsub_image_pal[c]);
+                  map[c] = s->img[p];
+                }
+              else
+                  s->img[p] = map[c];
             } /*for*/
+          seedtransparent = y == 0 && textsub_image_x1 < movie_width;
+            /* whole frame would have continued into transparent area to right of box */
       } /*for*/
     return 0;
   } /*read_frame*/
@@ -338,22 +625,42 @@ static int read_pic(stinfo *s, pict *p)
   /* gets the image(s) specified by p into s. */
   {
     int r = 0;
-    if (have_textsub)
+    if (s->sub_title)
       {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&renderlock);
+#endif
         vo_update_osd(s->sub_title); /* will allocate and render into textsub_image_buffer */
-        s->forced = text_forceit;
         r = read_frame(p);
+        if (p == &s->img)
+          {
+          /* only the area containing the text was converted, position it accordingly */
+            s->x0 += textsub_image_x0;
+            s->y0 += textsub_image_y0;
+          } /*if*/
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&renderlock);
+#endif
       }
     else /* read image file */
       {
+        struct stat st;
+        bool cacheable;
         if (!p->fname)
             return 0;
+        cacheable = stat(p->fname, &st) == 0 && S_ISREG(st.st_mode);
+        if (!cacheable || !imagecache_get(p, &st))
+          {
 #if defined(HAVE_MAGICK) || defined(HAVE_GMAGICK)
-        r = read_magick(p);
+            r = read_magick(p);
 #else
-        r = read_png(p);
+            r = read_png(p);
 #endif
+            if (!r && cacheable)
+                imagecache_put(p, &st);
+          } /*if*/
       } /*if*/
+    colorhash_free(p);
     if (!r)
         scanpict(s, p);
     return r;
@@ -384,31 +691,24 @@ static int gettricolor(stinfo *s,int p,int useimg)
             s->sel.img[p];
   } /*gettricolor*/
 
-static bool pickbuttongroups(stinfo *s, int ng, int useimg)
-  /* tries to assign the buttons in s to ng unique groups. useimg indicates
-    whether to look at the pixels in s->img in addition to s->hlt and s->sel. */
+static void findbuttoncolors(stinfo *s, palgroup *bpgs[2], bool fits[2])
+  /* checks the button coordinates make sense, and determines the set of tricolours
+    used by each button in a single scan of the images. bpgs[1] gets the sets including
+    the s->img component, bpgs[0] the sets without it. fits[useimg] is set to whether
+    the corresponding sets are all small enough for a button palette. */
   {
-    palgroup *bpgs, *gs;
-    int i, x, y, j, k, enb;
+    int i, x, y;
 
-    bpgs = malloc(s->numbuttons * sizeof(palgroup)); /* colour tables for each button */
-    memset(bpgs, 0, s->numbuttons * sizeof(palgroup));
+    fits[0] = true;
+    fits[1] = true;
 
-    gs = malloc(ng * sizeof(palgroup)); /* colour tables for each button group */
-    memset(gs, 0, ng * sizeof(palgroup));
-
-    assert(!useimg || (s->xd <= s->img.width && s->yd <= s->img.height));
+    assert(s->xd <= s->img.width && s->yd <= s->img.height);
     assert(s->xd <= s->hlt.width && s->yd <= s->hlt.height);
     assert(s->xd <= s->sel.width && s->yd <= s->sel.height);
 
-    // fprintf(stderr,"attempt %d groups, %d useimg\n",ng,useimg);
-    // find unique colors per button
     for (i = 0; i < s->numbuttons; i++)
       {
-      /* check coordinates of buttons make sense, and determine their colour tables */
-        button *b = &s->buttons[i];
-        palgroup *bp = &bpgs[i]; /* button's combined colour table for all images */
-
+        const button *b = &s->buttons[i];
         if
           (
                 b->r.x0 != b->r.x1
@@ -442,11 +742,32 @@ static bool pickbuttongroups(stinfo *s, int ng, int useimg)
           } /*if*/
         for (y = b->r.y0; y < b->r.y1; y++)
             for (x = b->r.x0; x < b->r.x1; x++)
-                if (!checkcolor(bp, gettricolor(s, y * s->xd + x, useimg)))
-                    goto impossible;
-        // fprintf(stderr, "pbg: button %d has %d colors\n", i, bp->numpal);
+              {
+                const int c = gettricolor(s, y * s->xd + x, 1);
+                if (fits[1] && !checkcolor(&bpgs[1][i], c))
+                    fits[1] = false;
+                if (!checkcolor(&bpgs[0][i], c & 0xFFFF))
+                  {
+                    fits[0] = false;
+                    return; /* no point looking further */
+                  } /*if*/
+              } /*for; for*/
+        // fprintf(stderr, "fbc: button %d has %d colors\n", i, bpgs[0][i].numpal);
       } /*for i*/
+  } /*findbuttoncolors*/
+
+static bool pickbuttongroups(stinfo *s, const palgroup *bpgs, int ng, int useimg)
+  /* tries to assign the buttons in s to ng unique groups. useimg indicates
+    whether to look at the pixels in s->img in addition to s->hlt and s->sel;
+    bpgs holds the colour tables for each button, as determined by findbuttoncolors. */
+  {
+    palgroup *gs;
+    int i, j, k, enb;
+
+    gs = malloc(ng * sizeof(palgroup)); /* colour tables for each button group */
+    memset(gs, 0, ng * sizeof(palgroup));
 
+    // fprintf(stderr,"attempt %d groups, %d useimg\n",ng,useimg);
     // assign to groups
     enb = 1;
     for (i = 0; i < s->numbuttons; i++)
@@ -464,7 +785,7 @@ static bool pickbuttongroups(stinfo *s, int ng, int useimg)
             int l;
             palgroup *pd = &gs[k % ng];
               /* palette for group to which to try to assign this button */
-            palgroup *ps = &bpgs[j]; /* palette for button */
+            const palgroup *ps = &bpgs[j]; /* palette for button */
 
             s->buttons[j].grp = k % ng + 1; /* assign button group */
             // fprintf(stderr, "%s%d",j?", ":"", s->buttons[j].grp);
@@ -525,7 +846,6 @@ ui_found:
                     s->groupmap[j][k] = -1; /* unused palette entries */
               } /*for*/
           } /*if*/
-        free(bpgs);
         free(gs);
 
         // If possible, make each palette entry 0 transparent in
@@ -595,8 +915,6 @@ trynext:
         continue; // 'deprecated use of label at end of compound statement'
       } /*for i*/
 
-impossible:
-    free(bpgs);
     free(gs);
     return false;
   } /*pickbuttongroups*/
@@ -735,133 +1053,252 @@ static void detectdirections(stinfo *s)
 #define MAX(a,b) (((a)>(b))?(a):(b))
 #define MIN(a,b) (((a)<(b))?(a):(b))
 
-static bool scanvline(stinfo *s,unsigned char *v,rectangle *r,int x,int d)
-{
-    int i,j;
-
-    for( j=1; j<=s->outlinewidth; j++ ) {
-        x+=d;
-        if( x<0 || x>=s->xd )
-            return false;
-        for( i=MAX(r->y0-j,0); i<MIN(r->y1+j,s->yd); i++ )
-            if( v[i*s->xd+x] )
-                return true;
-    }
-    return false;
-}
-
-static bool scanhline(stinfo *s,unsigned char *v,rectangle *r,int y,int d)
-{
-    int i,j;
+typedef struct { /* a candidate button found by detectbuttons */
+    rectangle r;
+    int seq; /* order of detection */
+    bool used; /* already assigned to a button */
+} autobutton;
 
-    for( j=1; j<=s->outlinewidth; j++ ) {
-        y+=d;
-        if( y<0 || y>=s->yd )
-            return false;
-        for( i=MAX(r->x0-j,0); i<MIN(r->x1+j,s->xd); i++ )
-            if( v[y*s->xd+i] )
-                return true;
-    }
-    return false;
-}
+static int autobutton_rowcompare(const void *a, const void *b)
+  /* sort comparator for autobuttons: top to bottom, then left to right, then
+    by order of detection. */
+  {
+    const autobutton * const ba = (const autobutton *)a;
+    const autobutton * const bb = (const autobutton *)b;
+    return
+        ba->r.y0 != bb->r.y0 ?
+            ba->r.y0 - bb->r.y0
+        : ba->r.x0 != bb->r.x0 ?
+            ba->r.x0 - bb->r.x0
+        :
+            ba->seq - bb->seq;
+  } /*autobutton_rowcompare*/
+
+static int autobutton_columncompare(const void *a, const void *b)
+  /* sort comparator for autobuttons: left to right, then top to bottom, then
+    by order of detection. */
+  {
+    const autobutton * const ba = (const autobutton *)a;
+    const autobutton * const bb = (const autobutton *)b;
+    return
+        ba->r.x0 != bb->r.x0 ?
+            ba->r.x0 - bb->r.x0
+        : ba->r.y0 != bb->r.y0 ?
+            ba->r.y0 - bb->r.y0
+        :
+            ba->seq - bb->seq;
+  } /*autobutton_columncompare*/
+
+static int findroot(int *parent, int i)
+  /* returns the representative of the set containing i. */
+  {
+    while (parent[i] != i)
+      {
+        parent[i] = parent[parent[i]]; /* path halving */
+        i = parent[i];
+      } /*while*/
+    return i;
+  } /*findroot*/
 
 static void detectbuttons(stinfo *s)
-  /* does automatic detection of button outlines. */
-{
-    unsigned char *visitmask=malloc(s->xd*s->yd);
-    int i,x,y;
-    rectangle *rs=0;
-    int numr=0;
-
-    if( !s->outlinewidth )
-        s->outlinewidth=1;
-    for( i=0; i<s->xd*s->yd; i++ )
-        visitmask[i]=( s->hlt.pal[s->hlt.img[i]].a || s->sel.pal[s->sel.img[i]].a ) ? 1 : 0;
-    for( y=0; y<s->yd; y++ )
-        for( x=0; x<s->xd; x++ )
-            if( visitmask[y*s->xd+x] ) {
-                rectangle r;
-                bool didwork;
-
-                r.x0=x;
-                r.y0=y;
-                r.x1=x+1;
-                r.y1=y+1;
-
-                do {
-                    didwork = false;
-                    while( scanvline(s,visitmask,&r,r.x0,-1) ) {
-                        r.x0--;
-                        didwork = true;
-                    }
-                    while( scanvline(s,visitmask,&r,r.x1-1,1) ) {
-                        r.x1++;
-                        didwork = true;
-                    }
-                    while( scanhline(s,visitmask,&r,r.y0,-1) ) {
-                        r.y0--;
-                        didwork = true;
-                    }
-                    while( scanhline(s,visitmask,&r,r.y1-1,1) ) {
-                        r.y1++;
+  /* does automatic detection of button outlines. Each button is the smallest
+    rectangle containing a group of visible highlight/select pixels, such that
+    there are no more such pixels within outlinewidth of it. */
+  {
+    const int w = s->outlinewidth ? s->outlinewidth : 1;
+    int * const label = malloc(s->xd * s->yd * sizeof(int));
+      /* component each pixel belongs to, 0 for none */
+    int *parent = malloc(sizeof(int)); /* union-find forest over labels */
+    int numlabels = 1, maxlabels = 1;
+    rectangle *bounds; /* bounding box of each component */
+    int *order; /* components in order of first pixel */
+    bool *taken; /* whether each component has been assigned to a button yet */
+    int numorder = 0;
+    autobutton *rs = 0; /* in order of detection */
+    autobutton *sorted; /* copy of rs in order of position */
+    int numr = 0, maxr = 0;
+    int i, j, k, x, y;
+
+    s->outlinewidth = w;
+    parent[0] = 0;
+  /* first pass: label pixels, uniting labels of pixels within w of each other */
+    for (y = 0; y < s->yd; y++)
+        for (x = 0; x < s->xd; x++)
+          {
+            const int p = y * s->xd + x;
+            int y1, x1, thislabel = 0;
+            if (!s->hlt.pal[s->hlt.img[p]].a && !s->sel.pal[s->sel.img[p]].a)
+              {
+                label[p] = 0;
+                continue;
+              } /*if*/
+          /* look at neighbours already visited */
+            for (y1 = MAX(y - w, 0); y1 <= y; y1++)
+                for (x1 = MAX(x - w, 0); x1 < (y1 < y ? MIN(x + w + 1, s->xd) : x); x1++)
+                  {
+                    const int otherlabel = label[y1 * s->xd + x1];
+                    if (otherlabel)
+                      {
+                        if (!thislabel)
+                            thislabel = findroot(parent, otherlabel);
+                        else
+                          {
+                            const int otherroot = findroot(parent, otherlabel);
+                            if (otherroot != thislabel)
+                              {
+                              /* keep lower-numbered label as root */
+                                if (otherroot < thislabel)
+                                  {
+                                    parent[thislabel] = otherroot;
+                                    thislabel = otherroot;
+                                  }
+                                else
+                                    parent[otherroot] = thislabel;
+                              } /*if*/
+                          } /*if*/
+                      } /*if*/
+                  } /*for; for*/
+            if (!thislabel)
+              {
+              /* start a new component */
+                if (numlabels == maxlabels)
+                  {
+                    maxlabels *= 2;
+                    parent = realloc(parent, maxlabels * sizeof(int));
+                  } /*if*/
+                thislabel = numlabels++;
+                parent[thislabel] = thislabel;
+              } /*if*/
+            label[p] = thislabel;
+          } /*for; for*/
+  /* second pass: resolve labels, and find bounding box of each component */
+    bounds = malloc(numlabels * sizeof(rectangle));
+    order = malloc(numlabels * sizeof(int));
+    taken = malloc(numlabels * sizeof(bool));
+    for (i = 0; i < numlabels; i++)
+        taken[i] = false;
+    for (y = 0; y < s->yd; y++)
+        for (x = 0; x < s->xd; x++)
+          {
+            const int p = y * s->xd + x;
+            int root;
+            if (!label[p])
+                continue;
+            root = findroot(parent, label[p]);
+            label[p] = root;
+            if (!taken[root])
+              {
+              /* first pixel of this component */
+                taken[root] = true;
+                order[numorder++] = root;
+                bounds[root].x0 = x;
+                bounds[root].y0 = y;
+                bounds[root].x1 = x + 1;
+                bounds[root].y1 = y + 1;
+              }
+            else
+              {
+                if (x < bounds[root].x0)
+                    bounds[root].x0 = x;
+                if (x >= bounds[root].x1)
+                    bounds[root].x1 = x + 1;
+                bounds[root].y1 = y + 1;
+              } /*if*/
+          } /*for; for*/
+    for (i = 0; i < numlabels; i++)
+        taken[i] = false;
+  /* grow a button from each component not already included in a previous one,
+    in order of first pixel */
+    for (i = 0; i < numorder; i++)
+      {
+        rectangle r;
+        bool didwork;
+        if (taken[order[i]])
+            continue;
+        taken[order[i]] = true;
+        r = bounds[order[i]];
+        do
+          {
+          /* add in all other components with a pixel within w of r */
+            const int xlo = MAX(r.x0 - w, 0), xhi = MIN(r.x1 + w, s->xd);
+            const int ylo = MAX(r.y0 - w, 0), yhi = MIN(r.y1 + w, s->yd);
+            didwork = false;
+            for (y = ylo; y < yhi; y++)
+                for (x = xlo; x < xhi; x++)
+                  {
+                    const int root = label[y * s->xd + x];
+                    if (root && !taken[root])
+                      {
+                        taken[root] = true;
+                        r.x0 = MIN(r.x0, bounds[root].x0);
+                        r.y0 = MIN(r.y0, bounds[root].y0);
+                        r.x1 = MAX(r.x1, bounds[root].x1);
+                        r.y1 = MAX(r.y1, bounds[root].y1);
                         didwork = true;
-                    }
-                } while(didwork);
-
-                r.y0-=r.y0&1; // buttons need even 'y' coordinates
-                r.y1+=r.y1&1;
-
-                // add button r
-                rs=realloc(rs,(numr+1)*sizeof(rectangle));
-                rs[numr++]=r;
-
-                // reset so we pass over
-                for( i=r.y0; i<r.y1; i++ )
-                    memset(visitmask+i*s->xd+r.x0,0,r.x1-r.x0);
-            }
-    free(visitmask);
-
-    while(numr) {
-        int j=0;
-        // find the left most button on the top row
-        if( !s->autoorder ) {
-            for( i=1; i<numr; i++ )
-                if( rs[i].y0 < rs[j].y0 ||
-                    (rs[i].y0==rs[j].y0 && rs[i].x0 < rs[j].x0 ) )
-                    j=i;
-        } else {
-            for( i=1; i<numr; i++ )
-                if( rs[i].x0 < rs[j].x0 ||
-                    (rs[i].x0==rs[j].x0 && rs[i].y0 < rs[j].y0 ) )
-                    j=i;
-        }
+                      } /*if*/
+                  } /*for; for*/
+          }
+        while (didwork);
+        r.y0 -= r.y0 & 1; // buttons need even 'y' coordinates
+        r.y1 += r.y1 & 1;
+        if (numr == maxr)
+          {
+            maxr = maxr ? maxr * 2 : 8;
+            rs = realloc(rs, maxr * sizeof(autobutton));
+          } /*if*/
+        rs[numr].r = r;
+        rs[numr].seq = numr;
+        rs[numr].used = false;
+        numr++;
+      } /*for*/
+    free(label);
+    free(parent);
+    free(bounds);
+    free(order);
+    free(taken);
+
+    sorted = malloc(numr * sizeof(autobutton));
+    memcpy(sorted, rs, numr * sizeof(autobutton));
+    qsort(sorted, numr, sizeof(autobutton), s->autoorder ? autobutton_columncompare : autobutton_rowcompare);
+    for (k = 0; k < numr; k++)
+      {
+      /* take the left most button on the top row (or top button in left column)
+        not yet taken */
+        if (rs[sorted[k].seq].used)
+            continue;
+        j = sorted[k].seq;
         // see if there are any buttons to the left, i.e. slightly overlapping vertically, but possibly start a little lower
-        for( i=0; i<numr; i++ )
-            if( i!=j ) {
-                int a,d;
-                if(buttonrelpos(rs+i,rs+j,&a,&d))
-                    if( a==(s->autoorder?0:270) )
-                        j=i;
-            }
+        for (i = 0; i < numr; i++)
+            if (i != j && !rs[i].used)
+              {
+                int a, d;
+                if (buttonrelpos(&rs[i].r, &rs[j].r, &a, &d))
+                    if (a == (s->autoorder ? 0 : 270))
+                        j = i;
+              } /*if; for*/
 
         // ok add rectangle 'j'
 
-        for( i=0; i<s->numbuttons; i++ )
-            if( s->buttons[i].r.x0<0 )
+        for (i = 0; i < s->numbuttons; i++)
+            if (s->buttons[i].r.x0 < 0)
                 break;
-        if( i==s->numbuttons ) {
+        if (i == s->numbuttons)
+          {
             s->numbuttons++;
-            s->buttons=realloc(s->buttons,s->numbuttons*sizeof(button));
-            memset(s->buttons+i,0,sizeof(button));
-        }
+            s->buttons = realloc(s->buttons, s->numbuttons * sizeof(button));
+            memset(s->buttons + i, 0, sizeof(button));
+          } /*if*/
 
-        fprintf(stderr,"INFO: Autodetect %d = %dx%d-%dx%d\n",i,rs[j].x0,rs[j].y0,rs[j].x1,rs[j].y1);
+        fprintf(stderr, "INFO: Autodetect %d = %dx%d-%dx%d\n", i, rs[j].r.x0, rs[j].r.y0, rs[j].r.x1, rs[j].r.y1);
 
-        s->buttons[i].r=rs[j];
-        memmove(rs+j,rs+j+1,(numr-j-1)*sizeof(rectangle));
-        numr--;
-    }
-}
+        s->buttons[i].r = rs[j].r;
+        rs[j].used = true;
+        if (j != sorted[k].seq)
+            k--; /* this one still not taken, look at it again */
+      } /*for*/
+    free(sorted);
+    free(rs);
+  } /*detectbuttons*/
 
 static bool imgfix(stinfo *s)
   /* fills in the subpicture/button details. */
@@ -886,17 +1323,27 @@ static bool imgfix(stinfo *s)
     useimg = 1;
     if (s->numbuttons)
       {
+        palgroup *bpgs[2]; /* colour tables for each button, without and with s->img */
+        bool fits[2];
+        bpgs[0] = calloc(s->numbuttons, sizeof(palgroup));
+        bpgs[1] = calloc(s->numbuttons, sizeof(palgroup));
+        findbuttoncolors(s, bpgs, fits);
         do
           {
-            if (pickbuttongroups(s, 1, useimg))
-                break;
-            if (pickbuttongroups(s, 2, useimg))
-                break;
-            if (pickbuttongroups(s, 3, useimg))
-                break;
+            if (fits[useimg])
+              {
+                if (pickbuttongroups(s, bpgs[useimg], 1, useimg))
+                    break;
+                if (pickbuttongroups(s, bpgs[useimg], 2, useimg))
+                    break;
+                if (pickbuttongroups(s, bpgs[useimg], 3, useimg))
+                    break;
+              } /*if*/
             useimg--;
           }
         while (useimg >= 0);
+        free(bpgs[0]);
+        free(bpgs[1]);
         assert(useimg); // at this point I don't want to deal with blocking the primary subtitle image
         if (useimg < 0)
           {
@@ -1021,6 +1468,205 @@ if_found:
     return true;
   } /*imgfix*/
 
+// ****************************************************
+//
+// Sharing of identical text subtitles. Lines like "[laughs]" can occur
+// many times in a subtitle file; these are only rendered, processed and
+// encoded once, and each occurrence gets a copy of the result.
+
+#define SPUCACHE_HASHSIZE 1024 /* power of 2 */
+
+struct spucache_entry { /* the processed form of a text subtitle */
+    spucache_entry *next; /* next entry in same hash chain */
+    char *key; /* alignment and text lines of subtitle */
+    unsigned int hash; /* hash of key */
+    int refs; /* nr of subtitles sharing this entry not yet freed */
+    bool processed; /* whether following fields have been filled in yet */
+    unsigned int x0, y0, xd, yd;
+    int numpal;
+    colorspec pal[4];
+    colorspec masterpal[16];
+    unsigned char *fimg; /* xd * yd */
+    unsigned char *pixels; /* encoded pixel data (DVD only), NULL if not done yet */
+    int pixelslen, pixelsofs1; /* length of pixels, offset to bottom field within it */
+};
+
+static spucache_entry *spucache[SPUCACHE_HASHSIZE];
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t spucachelock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static char *spucache_key(const subtitle_elt *t)
+  /* returns a string uniquely identifying what subtitle t will look like when rendered. */
+  {
+    size_t len = 4;
+    char *key, *k;
+    int i;
+    for (i = 0; i < t->lines; i++)
+        len += strlen(t->text[i]) + 1;
+    key = malloc(len);
+    k = key + sprintf(key, "%u", t->alignment);
+    for (i = 0; i < t->lines; i++)
+        k += sprintf(k, "\n%s", t->text[i]);
+    return key;
+  } /*spucache_key*/
+
+static unsigned int spucache_hash(const char *key)
+  {
+    unsigned int h = 2166136261U; /* FNV-1a */
+    while (*key)
+        h = (h ^ (unsigned char)*key++) * 16777619U;
+    return h;
+  } /*spucache_hash*/
+
+static void spucache_lock(void)
+  {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&spucachelock);
+#endif
+  } /*spucache_lock*/
+
+static void spucache_unlock(void)
+  {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&spucachelock);
+#endif
+  } /*spucache_unlock*/
+
+void spucache_share(stinfo *s)
+  {
+    char * const key = spucache_key(s->sub_title);
+    const unsigned int hash = spucache_hash(key);
+    spucache_entry *e;
+    spucache_lock();
+    for (e = spucache[hash & (SPUCACHE_HASHSIZE - 1)]; e; e = e->next)
+        if (e->hash == hash && !strcmp(e->key, key))
+            break;
+    if (e)
+        free(key);
+    else
+      {
+        e = malloc(sizeof(spucache_entry));
+        memset(e, 0, sizeof(spucache_entry));
+        e->key = key;
+        e->hash = hash;
+        e->next = spucache[hash & (SPUCACHE_HASHSIZE - 1)];
+        spucache[hash & (SPUCACHE_HASHSIZE - 1)] = e;
+      } /*if*/
+    e->refs++;
+    s->cached = e;
+    spucache_unlock();
+  } /*spucache_share*/
+
+void spucache_release(stinfo *s)
+  {
+    spucache_entry * const e = s->cached;
+    bool last;
+    if (!e)
+        return;
+    s->cached = 0;
+    spucache_lock();
+    last = --e->refs == 0;
+    if (last)
+      {
+        spucache_entry **prev;
+        for (prev = &spucache[e->hash & (SPUCACHE_HASHSIZE - 1)]; *prev != e; prev = &(*prev)->next)
+          /* find link to e */;
+        *prev = e->next;
+      } /*if*/
+    spucache_unlock();
+    if (last)
+      {
+        free(e->key);
+        free(e->fimg);
+        free(e->pixels);
+        free(e);
+      } /*if*/
+  } /*spucache_release*/
+
+static bool spucache_get(stinfo *s)
+  /* fills in s from an identical subtitle already processed, if there is one.
+    Returns true iff found. */
+  {
+    const spucache_entry * const e = s->cached;
+    bool found;
+    if (!e)
+        return false;
+    spucache_lock();
+    found = e->processed;
+    if (found)
+      {
+        s->x0 = e->x0;
+        s->y0 = e->y0;
+        s->xd = e->xd;
+        s->yd = e->yd;
+        s->numpal = e->numpal;
+        memcpy(s->pal, e->pal, sizeof s->pal);
+        memcpy(s->masterpal, e->masterpal, sizeof s->masterpal);
+        s->fimg = malloc(e->xd * e->yd);
+        memcpy(s->fimg, e->fimg, e->xd * e->yd);
+      } /*if*/
+    spucache_unlock();
+    return found;
+  } /*spucache_get*/
+
+static void spucache_put(const stinfo *s)
+  /* saves the processed form of s for reuse by identical subtitles. */
+  {
+    spucache_entry * const e = s->cached;
+    if (!e)
+        return;
+    spucache_lock();
+    if (!e->processed && e->refs > 1)
+      {
+        e->x0 = s->x0;
+        e->y0 = s->y0;
+        e->xd = s->xd;
+        e->yd = s->yd;
+        e->numpal = s->numpal;
+        memcpy(e->pal, s->pal, sizeof e->pal);
+        memcpy(e->masterpal, s->masterpal, sizeof e->masterpal);
+        e->fimg = malloc(s->xd * s->yd);
+        memcpy(e->fimg, s->fimg, s->xd * s->yd);
+        e->processed = true;
+      } /*if*/
+    spucache_unlock();
+  } /*spucache_put*/
+
+bool spucache_getpixels(const stinfo *s, unsigned char *data, int *len, int *offset1)
+  {
+    const spucache_entry * const e = s->cached;
+    bool found;
+    if (!e)
+        return false;
+    spucache_lock();
+    found = e->pixels != 0;
+    if (found)
+      {
+        memcpy(data, e->pixels, e->pixelslen);
+        *len = e->pixelslen;
+        *offset1 = e->pixelsofs1;
+      } /*if*/
+    spucache_unlock();
+    return found;
+  } /*spucache_getpixels*/
+
+void spucache_putpixels(const stinfo *s, const unsigned char *data, int len, int offset1)
+  {
+    spucache_entry * const e = s->cached;
+    if (!e)
+        return;
+    spucache_lock();
+    if (!e->pixels && e->refs > 1)
+      {
+        e->pixels = malloc(len);
+        memcpy(e->pixels, data, len);
+        e->pixelslen = len;
+        e->pixelsofs1 = offset1;
+      } /*if*/
+    spucache_unlock();
+  } /*spucache_putpixels*/
+
 bool process_subtitle(stinfo *s)
   /* loads the specified image files and builds the subpicture in memory. */
 {
@@ -1028,6 +1674,7 @@ bool process_subtitle(stinfo *s)
     int iline=0;
 
     if( !s ) return false;
+    if( spucache_get(s) ) return true;
     if( read_pic(s,&s->img) ) {
         if(debug > -1)
             fprintf(stderr, "WARN: Bad image,  skipping line %d\n", iline - 1);
@@ -1091,6 +1738,7 @@ bool process_subtitle(stinfo *s)
         }
         return false;
     }
+    spucache_put(s);
 
     return true;
 }
@@ -1104,6 +1752,7 @@ void image_init()
 
 void image_shutdown()
 {
+    imagecache_flush();
 #if defined(HAVE_MAGICK) || defined(HAVE_GMAGICK)
     DestroyMagick();
 #endif
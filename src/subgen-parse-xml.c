@@ -84,22 +84,71 @@ static unsigned int parsetime(const char *t)
   } /*parsetime*/
 
 static bool
-    had_stream = false, /* whether I've seen <stream> */
-    had_spu = false, /* whether I've seen <spu> */
-    had_textsub = false; /* whether I've seen <textsub> */
+    had_spu = false, /* whether I've seen <spu> in current stream */
+    had_textsub = false; /* whether I've seen <textsub> in current stream */
 static stinfo *curspu = 0; /* current <spu> directive collected here */
 static button *curbutton=0;
 static char * filename = 0;
 
+struct textrender_settings { /* global settings that apply to rendering all text subtitles */
+    char *font;
+    float fontsize, outline_thickness;
+    colorspec fill_color, outline_color, shadow_color;
+    int shadow_dx, shadow_dy;
+    int h_alignment, v_alignment;
+    int l_margin, r_margin, b_margin, t_margin;
+    int movie_width, movie_height;
+    bool widescreen;
+};
+static struct textrender_settings prev_textrender; /* as left by previous <textsub> */
+
+static void get_textrender_settings(struct textrender_settings *s)
+  {
+    memset(s, 0, sizeof(struct textrender_settings)); /* so memcmp works */
+    s->font = sub_font;
+    s->fontsize = text_font_scale_factor;
+    s->outline_thickness = subtitle_font_thickness;
+    s->fill_color = subtitle_fill_color;
+    s->outline_color = subtitle_outline_color;
+    s->shadow_color = subtitle_shadow_color;
+    s->shadow_dx = subtitle_shadow_dx;
+    s->shadow_dy = subtitle_shadow_dy;
+    s->h_alignment = h_sub_alignment;
+    s->v_alignment = v_sub_alignment;
+    s->l_margin = sub_left_margin;
+    s->r_margin = sub_right_margin;
+    s->b_margin = sub_bottom_margin;
+    s->t_margin = sub_top_margin;
+    s->movie_width = movie_width;
+    s->movie_height = movie_height;
+    s->widescreen = widescreen;
+  } /*get_textrender_settings*/
+
+static spustream *curstream()
+  {
+    return &streams[numstreams - 1];
+  } /*curstream*/
+
 static void stream_begin()
   {
-    if (had_stream)
+    spustream *st;
+    streams = realloc(streams, (numstreams + 1) * sizeof(spustream));
+    st = &streams[numstreams++];
+    memset(st, 0, sizeof(spustream));
+    st->id = -1; /* to be assigned */
+    had_spu = false;
+    had_textsub = false;
+  } /*stream_begin*/
+
+static void stream_id(const char *v)
+  {
+    curstream()->id = strtounsigned(v, "stream id");
+    if (curstream()->id > 31)
       {
-        fprintf(stderr, "ERR:  Only one stream is currently allowed.\n");
+        fprintf(stderr, "ERR:  Invalid stream ID, must be in 0 .. 31\n");
         exit(1);
       } /*if*/
-    had_stream = true;
-  } /*stream_begin*/
+  } /*stream_id*/
 
 static void stream_video_format(const char *v)
   {
@@ -185,13 +234,13 @@ static void spu_complete()
             printtime(stime, curspu->spts);
             printtime(etime, curspu->sd);
             fprintf(stderr, "ERR:  sub has end (%s)<=start (%s), skipping\n", etime, stime);
-            nr_subtitles_skipped++;
+            curstream()->nr_skipped++;
             return;
           } /*if*/
         curspu->sd -= curspu->spts;
       } /*if*/
-    spus = realloc(spus, (numspus + 1) * sizeof(stinfo *));
-    spus[numspus++] = curspu;
+    curstream()->spus = realloc(curstream()->spus, (curstream()->numspus + 1) * sizeof(stinfo *));
+    curstream()->spus[curstream()->numspus++] = curspu;
     curspu = 0;
 }
 
@@ -278,21 +327,43 @@ static void textsub_begin()
       } /*if*/
     if (had_textsub)
       {
-        fprintf(stderr,"ERR:  Only one textsub is currently allowed.\n");
+        fprintf(stderr,"ERR:  Only one textsub is allowed per stream.\n");
         exit(1);
       } /*if*/
     had_textsub = true;
+    text_forceit = false; /* unless specified for this stream */
+    if (have_textsub)
+      /* rendering settings are common to all streams, can only be repeated, not changed */
+        get_textrender_settings(&prev_textrender);
   } /*textsub_begin*/
 
 static void textsub_complete()
   /* called on a </textsub> tag to load and parse the subtitles. */
   {
     int i;
+    spustream * const st = curstream();
     if (filename == NULL)
       {
         fprintf(stderr, "ERR:  Filename of subtitle file missing");
         exit(1);
       } /*if*/
+    if (have_textsub)
+      {
+        struct textrender_settings settings;
+        get_textrender_settings(&settings);
+        if (!strcmp(settings.font, prev_textrender.font))
+            settings.font = prev_textrender.font; /* so memcmp only compares names */
+        if (memcmp(&settings, &prev_textrender, sizeof(struct textrender_settings)))
+          {
+            fprintf
+              (
+                stderr,
+                "ERR:  All <textsub> streams must have the same font, colour, alignment,"
+                    " margin and movie size settings\n"
+              );
+            exit(1);
+          } /*if*/
+      } /*if*/
     textsub_subdata = sub_read_file(filename, movie_fps);
       /* fixme: sub_free never called! */
     if (textsub_subdata == NULL)
@@ -302,9 +373,8 @@ static void textsub_complete()
       } /*if*/
     filename = NULL; /* belongs to textsub_subdata now */
     have_textsub = true;
-    numspus = textsub_subdata->sub_num;
-    spus = realloc(spus, textsub_subdata->sub_num * sizeof(stinfo *));
-      /* fixme: need to make sure user doesn't specify both <textsub> and <spu> */
+    st->numspus = textsub_subdata->sub_num;
+    st->spus = malloc(textsub_subdata->sub_num * sizeof(stinfo *));
     for (i = 0; i < textsub_subdata->sub_num; ++i)
       {
         subtitle_elt * const thissub = textsub_subdata->subtitles + i;
@@ -328,7 +398,9 @@ static void textsub_complete()
             newspu->sd = (thissub->end - thissub->start) * 900;
           } /*if*/
         newspu->sub_title = thissub;
-        spus[i] = newspu;
+        newspu->forced = text_forceit;
+        spucache_share(newspu);
+        st->spus[i] = newspu;
       } /*for*/
     free(filename);
     filename = NULL;
@@ -426,6 +498,7 @@ static struct elemdesc spu_elems[]={
 
 static struct elemattr spu_attrs[]={
     {"subpictures","format",stream_video_format},
+    {"stream","id",stream_id},
     {"spu","image",spu_image},
     {"spu","highlight",spu_highlight},
     {"spu","select",spu_select},
@@ -34,6 +34,12 @@
 #include <fcntl.h>
 
 #include <netinet/in.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 
 #include "common.h"
 #include "conffile.h"
@@ -64,9 +70,33 @@ the subpicture stream ID, based off the following values */
 #define until_next_sub 1 //if 0 subs without length are made when subs are overlapping
 #define tbs  90
 
-static unsigned char *cbuf;
+#define IOBUFSIZE (256 * 1024) /* size of buffers for input and output MPEG streams */
+
+static unsigned char *inbuf, *outbuf;
+static int inpos, inlen; /* next unconsumed byte and end of valid data in inbuf */
+static bool ineof;
+static int outlen; /* bytes in outbuf not yet written */
+
+enum /* values for spustream.spustate entries */
+  {
+    SPU_WAITING, /* not yet processed */
+    SPU_READY, /* processed successfully */
+    SPU_FAILED, /* processing failed, to be skipped */
+  };
+
+#ifdef HAVE_PTHREAD
+/* subtitles are processed ahead of the mux position by a pool of worker threads */
+#define LOOKAHEAD_PER_WORKER 4 /* max subtitles per stream processed ahead of mux position */
+static int numworkers = -1; /* 0 => process subtitles on main thread as needed, -1 => not yet decided */
+static pthread_t *workers;
+static pthread_mutex_t worklock = PTHREAD_MUTEX_INITIALIZER;
+  /* protects workindex and spustate in all streams and workers_quit */
+static pthread_cond_t
+    workavail = PTHREAD_COND_INITIALIZER, /* signalled when there may be more for workers to do */
+    workdone = PTHREAD_COND_INITIALIZER; /* signalled when a worker finishes a subtitle */
+static bool workers_quit = false;
+#endif
 
-static unsigned int spuindex;
 static bool
     show_progress = false,
     dodvdauthor_data = true,
@@ -79,12 +109,10 @@ static uint64_t lps; /* output bytes written */
 int default_video_format = VF_NONE;
 bool widescreen = false;
 
-stinfo **spus=0;
-int numspus=0;
+spustream *streams = 0;
+int numstreams = 0;
 bool have_textsub = false;
 
-int nr_subtitles_skipped;
-
 static char header[32];
 
 unsigned char *sub;
@@ -94,10 +122,9 @@ static int max_sub_size;
 static bool substream_present[256];
 
 
-// these 4 lines of variables are used by muxnext() and main() to communicate
-static int subno,secsize,mode,fdo,header_size,muxrate;
-static unsigned char substr, *sector;
-static stinfo *newsti;
+// these 3 lines of variables are used by muxnext() and main() to communicate
+static int secsize,mode,fdo,muxrate;
+static unsigned char *sector;
 static uint64_t lastgts, nextgts;
 
 
@@ -321,6 +348,7 @@ static void freestinfo(stinfo *s)
     int i;
     if (!s)
         return;
+    spucache_release(s);
     free(s->img.img);
     free(s->hlt.img);
     free(s->sel.img);
@@ -397,59 +425,233 @@ static void wdstr(char *s)
     wdbyte(0);
 }
 
-static int sread(int h, void *b, int l)
-  /* reads l bytes into b from fd h. Returns actual nr bytes read, or -1 on error. */
+static unsigned char * sget(int h, int l)
+  /* returns a pointer to the next l bytes of input from fd h and consumes them,
+    or NULL if they could not all be read. The bytes are left in place in inbuf,
+    and remain valid until the next call. */
+  {
+    if (inlen - inpos < l && !ineof)
+      {
+      /* move unconsumed data to front, then refill as much of inbuf as possible */
+        memmove(inbuf, inbuf + inpos, inlen - inpos);
+        inlen -= inpos;
+        inpos = 0;
+        while (inlen < l)
+          {
+            const int r = read(h, inbuf + inlen, IOBUFSIZE - inlen);
+            if (r == -1)
+              {
+                fprintf(stderr, "WARN:  Read error %d -- %s\n", errno, strerror(errno));
+                ineof = true;
+                return NULL;
+              } /*if*/
+            if (!r)
+              {
+                ineof = true;
+                break;
+              } /*if*/
+            inlen += r;
+          } /*while*/
+      } /*if*/
+    if (inlen - inpos < l)
+      {
+        if (inlen - inpos)
+            fprintf(stderr, "WARN:  Read %d, expected %d\n", inlen - inpos, l);
+        inpos = inlen;
+        return NULL;
+      } /*if*/
+    inpos += l;
+    return inbuf + inpos - l;
+  } /*sget*/
+
+static bool sread(int h, void *b, int l)
+  /* reads l bytes into b from fd h. Returns false on EOF or error. */
   {
-    int tr = 0; /* count of bytes read */
-    while (l > 0)
+    const unsigned char * const p = sget(h, l);
+    if (p)
+        memcpy(b, p, l);
+    return p != NULL;
+  } /*sread*/
+
+static void swrite2(int h, const void *b1, int l1, const void *b2, int l2)
+  /* writes l1 bytes from b1 followed by l2 bytes from b2 to fd h. */
+  {
+    while (l1 + l2 > 0) /* keep trying until it's all written */
       {
-        int r = read(h, b, l);
+#ifdef HAVE_WRITEV
+        struct iovec iov[2];
+        int r;
+        iov[0].iov_base = (void *)b1;
+        iov[0].iov_len = l1;
+        iov[1].iov_base = (void *)b2;
+        iov[1].iov_len = l2;
+        r = writev(h, iov, 2);
+#else
+        const int r = l1 > 0 ? write(h, b1, l1) : write(h, b2, l2);
+#endif
         if (r == -1)
           {
-            fprintf(stderr, "WARN:  Read error %d -- %s\n", errno, strerror(errno));
-            return -1;
+            fprintf(stderr,"ERR:  Write error %d -- %s\n", errno, strerror(errno));
+            exit(1);
           } /*if*/
-        if (!r)
+        if (r >= l1)
+          {
+            b2 = ((const unsigned char *)b2) + (r - l1);
+            l2 -= r - l1;
+            l1 = 0;
+          }
+        else
           {
-            if (tr)
-                fprintf(stderr, "WARN:  Read %d, expected %d\n", tr + r, tr + l);
-            return tr;
+            b1 = ((const unsigned char *)b1) + r;
+            l1 -= r;
           } /*if*/
-        l -= r;
-        b = ((unsigned char *)b) + r;
-        tr += r;
       } /*while*/
-    return tr;
-  } /*sread*/
+  } /*swrite2*/
 
 static void swrite(int h, const void *b, int l)
-  /* writes l bytes from b to fd h. */
+  /* writes l bytes from b to fd h, buffered. */
   {
     lps += l;
-    while (l > 0) /* keep trying until it's all written */
+    if (outlen + l <= IOBUFSIZE)
       {
-        int r = write(h, b, l);
-        if (r == -1)
+        memcpy(outbuf + outlen, b, l);
+        outlen += l;
+      }
+    else
+      {
+      /* write out what is buffered together with the new data, without copying it */
+        swrite2(h, outbuf, outlen, b, l);
+        outlen = 0;
+      } /*if*/
+  } /*swrite*/
+
+static void sflush(int h)
+  /* writes out any data buffered by swrite. */
+  {
+    swrite2(h, outbuf, outlen, NULL, 0);
+    outlen = 0;
+  } /*sflush*/
+
+#ifdef HAVE_PTHREAD
+
+static spustream *nextjob(void)
+  /* returns the stream with the earliest subtitle still waiting to be handed to a
+    worker that is within the lookahead limit, if any. Caller must hold worklock. */
+  {
+    spustream *st = 0;
+    int i;
+    for (i = 0; i < numstreams; i++)
+      {
+        spustream * const thisst = &streams[i];
+        if
+          (
+                thisst->workindex < thisst->numspus
+            &&
+                thisst->workindex < thisst->spuindex + numworkers * LOOKAHEAD_PER_WORKER
+            &&
+                (
+                    !st
+                ||
+                    thisst->spus[thisst->workindex]->spts < st->spus[st->workindex]->spts
+                )
+          )
+            st = thisst;
+      } /*for*/
+    return st;
+  } /*nextjob*/
+
+static void *subtitle_worker(void *arg)
+  /* worker thread which keeps processing subtitles ahead of the mux position
+    until told to quit. */
+  {
+    pthread_mutex_lock(&worklock);
+    while (!workers_quit)
+      {
+        spustream * const st = nextjob();
+        unsigned int i;
+        bool ok;
+        if (!st)
           {
-            fprintf(stderr,"ERR:  Write error %d -- %s\n", errno, strerror(errno));
-            exit(1);
+            pthread_cond_wait(&workavail, &worklock);
+            continue;
           } /*if*/
-        l -= r;
-        b = ((const unsigned char *)b) + r;
+        i = st->workindex++;
+        pthread_mutex_unlock(&worklock);
+        ok = process_subtitle(st->spus[i]);
+        pthread_mutex_lock(&worklock);
+        st->spustate[i] = ok ? SPU_READY : SPU_FAILED;
+        pthread_cond_broadcast(&workdone);
       } /*while*/
-  } /*swrite*/
+    pthread_mutex_unlock(&worklock);
+    return NULL;
+  } /*subtitle_worker*/
 
-static stinfo *getnextsub(void)
-  /* processes and returns the next subtitle definition, if there is one. */
+static void start_workers(void)
+  /* starts the worker threads, if any. */
+  {
+    int i;
+    if (numworkers < 0)
+      {
+      /* default to one worker per CPU, none if only one CPU */
+        numworkers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (numworkers <= 1)
+            numworkers = 0;
+      } /*if*/
+    if (numworkers == 0)
+        return;
+    workers = malloc(numworkers * sizeof(pthread_t));
+    for (i = 0; i < numworkers; i++)
+        if (pthread_create(&workers[i], NULL, subtitle_worker, NULL))
+          {
+            fprintf(stderr, "ERR:  Cannot create worker thread\n");
+            exit(1);
+          } /*if; for*/
+    if (debug > 0)
+        fprintf(stderr, "INFO: Processing subtitles with %d worker threads\n", numworkers);
+  } /*start_workers*/
+
+static void stop_workers(void)
+  /* tells the worker threads to quit, and waits for them to do so. */
+  {
+    int i;
+    if (numworkers <= 0)
+        return;
+    pthread_mutex_lock(&worklock);
+    workers_quit = true;
+    pthread_cond_broadcast(&workavail);
+    pthread_mutex_unlock(&worklock);
+    for (i = 0; i < numworkers; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    workers = NULL;
+    numworkers = 0;
+  } /*stop_workers*/
+
+#endif
+
+static stinfo *getnextsub(spustream *st)
+  /* processes and returns the next subtitle definition for st, if there is one. */
   {
     while (true)
       {
         stinfo *s;
-        if (spuindex >= numspus) /* no more to return */
+        bool ok;
+        if (st->spuindex >= st->numspus) /* no more to return */
             return 0;
-        s = spus[spuindex++];
+        s = st->spus[st->spuindex];
         if (tofs > 0)
+          {
+#ifdef HAVE_PTHREAD
+          /* workers look at spts of pending subtitles when choosing what to do next */
+            if (numworkers > 0)
+                pthread_mutex_lock(&worklock);
+#endif
             s->spts += tofs;
+#ifdef HAVE_PTHREAD
+            if (numworkers > 0)
+                pthread_mutex_unlock(&worklock);
+#endif
+          } /*if*/
 /*      fprintf(stderr,"spts: %d\n",s->spts); */
         fprintf(stderr, "STAT: ");
         fprintf
@@ -461,20 +663,51 @@ static stinfo *getnextsub(void)
             (int)(s->spts / 90 / 1000) % 60,
             (int)(s->spts / 90) % 1000
           );
-        if (process_subtitle(s))
+#ifdef HAVE_PTHREAD
+        if (numworkers > 0)
+          {
+          /* wait for a worker to finish with it */
+            pthread_mutex_lock(&worklock);
+            while (st->spustate[st->spuindex] == SPU_WAITING)
+                pthread_cond_wait(&workdone, &worklock);
+            ok = st->spustate[st->spuindex] == SPU_READY;
+            st->spuindex++;
+            pthread_cond_broadcast(&workavail); /* lookahead window has moved on */
+            pthread_mutex_unlock(&worklock);
+          }
+        else
+#endif
+          {
+            st->spuindex++;
+            ok = process_subtitle(s);
+          } /*if*/
+        if (ok)
             return s;
         freestinfo(s);
-        nr_subtitles_skipped++;
+        st->nr_skipped++;
       } /*while*/
   } /*getnextsub*/
 
+static spustream *nextstream(void)
+  /* returns the stream with the earliest subtitle still to be inserted, if any. */
+  {
+    spustream *st = 0;
+    int i;
+    for (i = 0; i < numstreams; i++)
+        if (streams[i].newsti && (!st || streams[i].newsti->spts < st->newsti->spts))
+            st = &streams[i];
+    return st;
+  } /*nextstream*/
+
 static void usage()
 {
-    fprintf(stderr, "syntax: spumux [options] script.sub < in.mpg > out.mpg\n");
+    fprintf(stderr, "syntax: spumux [options] script.sub [script.sub ...] < in.mpg > out.mpg\n");
     fprintf(stderr, "\t-m <mode>   dvd, cvd, or svcd (only the first letter is checked).\n\t\tDefault is DVD.\n");
-    fprintf(stderr, "\t-s <stream> number of the substream to insert (default 0)\n");
+    fprintf(stderr, "\t-s <stream> number of the substream to insert (default 0); can be\n\t\trepeated, once for each stream in order\n");
     fprintf(stderr, "\t-v <level>  verbosity level (default 0) \n");
     fprintf(stderr, "\t-P          enable progress indicator\n");
+    fprintf(stderr, "\t-j <n>      nr of threads for processing subtitles (default one per CPU)\n");
+    fprintf(stderr, "\t-g <dir>    directory in which to cache rendered text subtitle glyphs\n");
     fprintf(stderr,"\n\tSee manpage for config file format.\n");
     exit(-1);
 }
@@ -483,20 +716,23 @@ static void muxnext(bool eoinput)
   {
     if (domux && (lastgts == 0 || tofs == -1 || (lps % secsize && !eoinput)))
         return;
-    while (newsti)
+    while (true)
       {
+        spustream * const st = nextstream();
         stinfo *cursti;
         int bytes_sent, sub_size;
         unsigned char seq;
         unsigned int q;
         int64_t duegts;
+        if (!st)
+            break;
       /* wait for correct time to insert sub, leave time for vpts to occur */
-        duegts = (newsti->spts - .15 * 90000) * 300;
+        duegts = (st->newsti->spts - .15 * 90000) * 300;
         if (duegts < 0)
             duegts = 0;
         if (domux && duegts > lastgts && !eoinput)
             break; /* not yet time */
-        cursti = newsti;
+        cursti = st->newsti;
         if (debug > 1)
           {
             fprintf
@@ -506,14 +742,14 @@ static void muxnext(bool eoinput)
                 cursti->xd, cursti->yd, cursti->x0, cursti->y0
               );
           } /*if*/
-        newsti = getnextsub();
-        if (!newsti)
+        st->newsti = getnextsub(st);
+        if (!st->newsti)
           {
             fprintf(stderr, "INFO: Found EOF in .sub file.\n");
           }
         else
           {
-            if (cursti->spts + cursti->sd + tbs > newsti->spts)
+            if (cursti->spts + cursti->sd + tbs > st->newsti->spts)
               {
                 if (debug > 4)
                   {
@@ -524,7 +760,7 @@ static void muxnext(bool eoinput)
                         "spts: %d sd: %d  nspts: %d\n",
                         cursti->spts / 90000,
                         cursti->sd / 90000,
-                        newsti->spts / 90000
+                        st->newsti->spts / 90000
                       );
                   } /*if*/
                 cursti->sd = -1;
@@ -532,10 +768,10 @@ static void muxnext(bool eoinput)
           } /*if*/
         if (debug > 4)
           {
-            if (newsti)
+            if (st->newsti)
               {
                 fprintf(stderr, "spts: %d  sd: %d  nspts: %d\n",
-                        cursti->spts / 90000, cursti->sd / 90000, newsti->spts / 90000);
+                        cursti->spts / 90000, cursti->sd / 90000, st->newsti->spts / 90000);
               }
             else
               {
@@ -543,19 +779,19 @@ static void muxnext(bool eoinput)
                         cursti->spts / 90000, cursti->sd / 90000);
               } /*if*/
           } /*if*/
-        if (cursti->sd == -1 && newsti && (!svcd_adjust || until_next_sub))
+        if (cursti->sd == -1 && st->newsti && (!svcd_adjust || until_next_sub))
           {
-            if (newsti->spts > cursti->spts + tbs)
-                cursti->sd = newsti->spts - cursti->spts - tbs;
+            if (st->newsti->spts > cursti->spts + tbs)
+                cursti->sd = st->newsti->spts - cursti->spts - tbs;
             else
               {
                 if (debug > -1)
                   {
                     fprintf(stderr,\
                             "WARN:  Sub with too short or negative duration on line %d, skipping\n",\
-                            spuindex - 1);
+                            st->spuindex - 1);
                   } /*if*/
-                nr_subtitles_skipped++;
+                st->nr_skipped++;
                 continue;
               } /*if*/
           } /*if*/
@@ -579,9 +815,9 @@ static void muxnext(bool eoinput)
           {
             if (debug > -1)
               {
-                fprintf(stderr, "WARN: Image too large (encoded size>64k), skipping line %d\n", spuindex - 1);
+                fprintf(stderr, "WARN: Image too large (encoded size>64k), skipping line %d\n", st->spuindex - 1);
               } /*if*/
-            nr_subtitles_skipped++;
+            st->nr_skipped++;
             continue;
           } /*if*/
         if (sub_size > max_sub_size)
@@ -591,7 +827,7 @@ static void muxnext(bool eoinput)
                 fprintf(stderr, "INFO: Max_sub_size=%d\n", max_sub_size);
           } /*if*/
         seq = 0;
-        subno++;
+        st->subno++;
         lastgts = duegts;
         if (mode == DVD_SUB)
           {
@@ -622,7 +858,7 @@ static void muxnext(bool eoinput)
                 wdstr("dvdauthor-data");
                 wdbyte(2); // version
                 wdbyte(1); // subtitle info
-                wdbyte(substr); // sub number
+                wdbyte(st->substr); // sub number
                 wdlong(cursti->spts); // start pts
                 wdlong(cursti->sd == -1 ? -1 : cursti->sd + cursti->spts); // end pts
 
@@ -737,11 +973,11 @@ static void muxnext(bool eoinput)
             uint16_t b;
           /* if not first time here */
             if (bytes_sent)
-                header_size = 4; /* empty MPEG-2 PES header extension on continuation packet */
-            else if (header_size != 12) // not first time
-                header_size = 9; /* drop PES extension from subsequent packets */
+                st->header_size = 4; /* empty MPEG-2 PES header extension on continuation packet */
+            else if (st->header_size != 12) // not first time
+                st->header_size = 9; /* drop PES extension from subsequent packets */
           /* calculate how many bytes to send */
-            bytes_this_packet = secsize - 20 - header_size - svcd_adjust;
+            bytes_this_packet = secsize - 20 - st->header_size - svcd_adjust;
             stuffing = bytes_this_packet - (sub_size - bytes_sent);
             if ( stuffing < 0)
                 stuffing = 0;
@@ -765,27 +1001,27 @@ static void muxnext(bool eoinput)
             c = htonl(0x100 + MPID_PRIVATE1);
             swrite(fdo, &c, 4);
           /* write packet length */
-            b = ntohs(bytes_this_packet + header_size + svcd_adjust + stuffing);
+            b = ntohs(bytes_this_packet + st->header_size + svcd_adjust + stuffing);
             swrite(fdo, &b, 2);
-            if (header_size == 9)
+            if (st->header_size == 9)
                 mkpesh0(cursti->spts);
-            else if (header_size == 12)
+            else if (st->header_size == 12)
                 mkpesh1(cursti->spts);
             else /* header_size = 4 */
                 mkpesh2();
             header[2] += stuffing; /* include in PES header data size */
-            memset(header + header_size - 1, 0xff, stuffing);
-            header[header_size + stuffing - 1] = /* substream ID */
+            memset(header + st->header_size - 1, 0xff, stuffing);
+            header[st->header_size + stuffing - 1] = /* substream ID */
                 svcd_adjust ?
                     SVCD_SUB_CHANNEL /* real subpicture stream number inserted below */
                 :
-                    substr; /* subpicture stream number */
-            swrite(fdo, header, header_size + stuffing);
+                    st->substr; /* subpicture stream number */
+            swrite(fdo, header, st->header_size + stuffing);
             if (svcd_adjust)
               {
               /* additional 4 byte svcd header */
-                const uint16_t cc = htons(subno);
-                swrite(fdo, &substr, 1); /* real subpicture stream number */
+                const uint16_t cc = htons(st->subno);
+                swrite(fdo, &st->substr, 1); /* real subpicture stream number */
                 if (bytes_sent + bytes_this_packet == sub_size)
                     seq |= 128; /* end of current sub */
                 swrite(fdo, &seq, 1); // packet number in current sub
@@ -797,7 +1033,7 @@ static void muxnext(bool eoinput)
             swrite(fdo, sub + bytes_sent, bytes_this_packet);
             bytes_sent += bytes_this_packet;
           /* test if full sector */
-            bytes_this_packet += 20 + header_size + stuffing + svcd_adjust;
+            bytes_this_packet += 20 + st->header_size + stuffing + svcd_adjust;
             if (bytes_this_packet != secsize)
               {
                 unsigned short bs;
@@ -837,6 +1073,9 @@ static void muxnext(bool eoinput)
 
 static void textsub_statistics()
   {
+    int i, numspus = 0;
+    for (i = 0; i < numstreams; i++)
+        numspus += streams[i].numspus;
     fprintf(stderr, "\nINFO: Text Subtitle Statistics:\n");
     fprintf(stderr, "INFO: - Processed %d subtitles.\n", numspus);
     fprintf(stderr, "INFO: - The longest display line had %d characters.\n", sub_max_chars - 1);
@@ -848,10 +1087,12 @@ static void textsub_statistics()
 
 int main(int argc,char **argv)
 {
-    int fdi;
+    int fdi, i;
     unsigned int c, ch, a;
+    unsigned int substrs[32]; /* from -s options */
+    int numsubstrs, usedsubstrs, nextsubstr, substrbase;
     unsigned short int b;
-    unsigned char psbuf[psbufs];
+    const unsigned char *psbuf, *cbuf;
     int optch;
 #ifdef HAVE_GETOPT_LONG
     const static struct option longopts[]={
@@ -866,7 +1107,6 @@ int main(int argc,char **argv)
 
     default_video_format = get_video_format();
     init_locale();
-    newsti = 0;
     mode = DVD_SUB; /* default */
     sub = malloc(SUB_BUFFER_MAX + SUB_BUFFER_HEADROOM);
     if (!sub)
@@ -875,9 +1115,11 @@ int main(int argc,char **argv)
         exit(1);
       } /*if*/
 //fprintf(stderr, "malloc sub=%p\n", sub);
-    if (!(cbuf = malloc(65536)))
+    inbuf = malloc(IOBUFSIZE);
+    outbuf = malloc(IOBUFSIZE);
+    if (!inbuf || !outbuf)
       {
-        fprintf(stderr, "ERR:  Could not allocate space for sub buffer, aborting.\n");
+        fprintf(stderr, "ERR:  Could not allocate space for I/O buffers, aborting.\n");
         exit(1);
       } /*if*/
     image_init();
@@ -907,8 +1149,8 @@ int main(int argc,char **argv)
       } /*if*/
     tofs = -1;
     debug = 0;
-    substr = 0; /* default */
-    while (-1 != (optch = GETOPTFUNC(argc, argv, "hm:s:v:P")))
+    numsubstrs = 0;
+    while (-1 != (optch = GETOPTFUNC(argc, argv, "hm:s:v:Pj:g:")))
       {
         switch (optch)
           {
@@ -936,12 +1178,18 @@ int main(int argc,char **argv)
               } /*switch*/
         break;
         case 's':
-            substr = strtounsigned(optarg, "substream id");
-            if (substr > 31)
+            if (numsubstrs == 32)
+              {
+                fprintf(stderr, "ERR:  Too many stream IDs\n");
+                exit(1);
+              } /*if*/
+            substrs[numsubstrs] = strtounsigned(optarg, "substream id");
+            if (substrs[numsubstrs] > 31)
               {
                 fprintf(stderr, "ERR:  Invalid stream ID, must be in 0 .. 31\n");
                 exit(1);
               } /*if*/
+            numsubstrs++;
         break;
         case 'v':
             debug = strtounsigned(optarg, "verbosity");
@@ -949,6 +1197,19 @@ int main(int argc,char **argv)
         case 'P':
             show_progress = true;
         break;
+        case 'j':
+#ifdef HAVE_PTHREAD
+            numworkers = strtounsigned(optarg, "thread count");
+            if (numworkers == 1)
+                numworkers = 0; /* no point having just one worker */
+#else
+            if (strtounsigned(optarg, "thread count") > 1)
+                fprintf(stderr, "WARN: Not built with thread support, ignoring -j\n");
+#endif
+        break;
+        case 'g':
+            glyph_cache_dir = optarg;
+        break;
         case 'h':
             usage();
         break;
@@ -964,9 +1225,9 @@ int main(int argc,char **argv)
         break;
           } /*switch*/
       } /*while*/
-    if (argc - optind != 1)
+    if (argc - optind < 1)
       {
-        fprintf(stderr, "WARN: Only one argument expected\n");
+        fprintf(stderr, "WARN: At least one argument expected\n");
         usage();
       } /*if*/
 
@@ -975,20 +1236,20 @@ int main(int argc,char **argv)
     case DVD_SUB:
     default:
         svcd_adjust = 0;
-        substr += DVD_SUB_CHANNEL;
+        substrbase = DVD_SUB_CHANNEL;
         muxrate = 10080 * 10 / 4; // 0x1131; // 10080 kbps
         secsize = 2048;
     break;
     case CVD_SUB:
         svcd_adjust = 0;
-        substr += CVD_SUB_CHANNEL;
+        substrbase = CVD_SUB_CHANNEL;
         muxrate = 1040 * 10/4; //0x0a28; // 1040 kbps
         secsize = 2324;
     break;
     case SVCD_SUB:
         svcd_adjust = 4;
         // svcd substream identification works differently...
-        // substr += SVCD_SUB_CHANNEL;
+        substrbase = 0; // not SVCD_SUB_CHANNEL
         muxrate = 1760 * 10 / 4; //0x1131; // 1760 kbps
         secsize = 2324;
     break;
@@ -1000,16 +1261,41 @@ int main(int argc,char **argv)
         win32_setmode(fdi,O_BINARY);
       } /*if*/
     win32_setmode(fdo,O_BINARY);
-    if (spumux_parse(argv[optind]))
-        return -1;
+    for (i = optind; i < argc; i++)
+        if (spumux_parse(argv[i]))
+            return -1;
+  /* assign substream IDs: from the stream's id attribute if present, else from the
+    next -s option, else following on from the previous stream */
+    usedsubstrs = 0;
+    nextsubstr = 0;
+    for (i = 0; i < numstreams; i++)
+      {
+        spustream * const st = &streams[i];
+        int j;
+        if (st->id < 0)
+            st->id = usedsubstrs < numsubstrs ? substrs[usedsubstrs++] : nextsubstr;
+        if (st->id > 31)
+          {
+            fprintf(stderr, "ERR:  Invalid stream ID %d, must be in 0 .. 31\n", st->id);
+            exit(1);
+          } /*if*/
+        for (j = 0; j < i; j++)
+            if (streams[j].id == st->id)
+              {
+                fprintf(stderr, "ERR:  More than one stream with ID %d\n", st->id);
+                exit(1);
+              } /*if; for*/
+        nextsubstr = st->id + 1;
+        st->substr = st->id + substrbase;
+        st->subno = -1;
+        st->header_size = 12; /* first PES header extension will have PTS data and a PES extension */
+      } /*for*/
     if (tofs >= 0 && debug > 0)
         fprintf(stderr, "INFO: Subtitles offset by %fs\n", (double)tofs / 90000);
     if (have_textsub)
       {
         vo_init_osd();
       } /*if*/
-    spuindex = 0;
-    nr_subtitles_skipped = 0;
     if (!(sector = malloc(secsize)))
       {
         fprintf(stderr, "ERR:  Could not allocate space for sector buffer, aborting.\n");
@@ -1017,17 +1303,26 @@ int main(int argc,char **argv)
       } /*if*/
     memset(substream_present, false, sizeof substream_present);
 
-    newsti = getnextsub();
+    for (i = 0; i < numstreams; i++)
+      {
+        spustream * const st = &streams[i];
+        st->spustate = malloc(st->numspus);
+        memset(st->spustate, SPU_WAITING, st->numspus);
+        st->workindex = 0;
+      } /*for*/
+#ifdef HAVE_PTHREAD
+    start_workers();
+#endif
+    for (i = 0; i < numstreams; i++)
+        streams[i].newsti = getnextsub(&streams[i]);
     max_sub_size = 0;
-    header_size = 12; /* first PES header extension will have PTS data and a PES extension */
     lps = 0;
     lastgts = 0;
     nextgts = 0;
-    subno = -1;
     while (domux)
       {
         muxnext(false);
-        if (sread(fdi, &c, 4) != 4)
+        if (!sread(fdi, &c, 4))
             goto eoi;
         ch = ntohl(c); /* header ID */
         if (ch == 0x100 + MPID_PACK)
@@ -1040,7 +1335,7 @@ l_01ba:
               } /*if*/
             if (debug > 5)
                 fprintf(stderr, "INFO: pack_start_code\n");
-            if (sread(fdi, psbuf, psbufs) != psbufs)
+            if (!(psbuf = sget(fdi, psbufs)))
                 break;
             lastgts = getgts(psbuf);
             if (lastgts != -1)
@@ -1062,11 +1357,11 @@ l_01ba:
         else if (ch >= 0x100 + MPID_SYSTEM && ch <= 0x100 + MPID_VIDEO_LAST)
           {
             swrite(fdo, &c, 4); /* packet header excl length */
-            if (sread(fdi, &b, 2) != 2)
+            if (!sread(fdi, &b, 2))
                 break;
             swrite(fdo, &b, 2); /* packet length */
             b = ntohs(b);
-            if (sread(fdi, cbuf, b) != b) /* packet contents */
+            if (!(cbuf = sget(fdi, b))) /* packet contents, left in input buffer */
                 break;
             if (ch == 0x100 + MPID_PRIVATE1)
               {
@@ -1083,11 +1378,12 @@ l_01ba:
                         -1;
                 if (substreamid >= 0)
                   {
-                    if (substreamid == substr)
-                      {
-                        fprintf(stderr, "ERR:  duplicate substream ID 0x%02x\n", substr);
-                        exit(1);
-                      } /*if*/
+                    for (i = 0; i < numstreams; i++)
+                        if (substreamid == streams[i].substr)
+                          {
+                            fprintf(stderr, "ERR:  duplicate substream ID 0x%02x\n", streams[i].substr);
+                            exit(1);
+                          } /*if; for*/
                     if (!substream_present[substreamid])
                       {
                         const char * modestr;
@@ -1132,8 +1428,9 @@ l_01ba:
                 a = getpts(cbuf);
                 if (a != -1)
                   {
-                    if (newsti)
-                        newsti->spts += a;
+                    for (i = 0; i < numstreams; i++)
+                        if (streams[i].newsti)
+                            streams[i].newsti->spts += a;
                     tofs = a;
                   } /*if*/
               } /*if*/
@@ -1155,7 +1452,7 @@ l_01ba:
             while (a != 0x100 + MPID_PACK) /* until next PACK header */
               {
                 unsigned char nc;
-                if (sread(fdi, &nc, 1) < 1)
+                if (!sread(fdi, &nc, 1))
                     goto eoi;
                 swrite(fdo, &nc, 1);
                 a = (a << 8) | nc;
@@ -1169,17 +1466,27 @@ l_01ba:
       } /*while*/
  eoi:
     muxnext(true); // end of input
+    sflush(fdo);
+#ifdef HAVE_PTHREAD
+    stop_workers();
+#endif
 /*    fprintf(stderr, "max_sub_size=%d\n", max_sub_size); */
-    if (subno != 0xffff)
-      {
-        fprintf(stderr,
-            "INFO: %d subtitles added, %d subtitles skipped, stream: %d, offset: %.2f\n",
-            subno + 1, nr_subtitles_skipped, substr, (double)tofs / 90000);
-      }
-    else
+    for (i = 0; i < numstreams; i++)
       {
+        const spustream * const st = &streams[i];
+        if (st->subno != 0xffff)
+          {
+            fprintf(stderr,
+                "INFO: %d subtitles added, %d subtitles skipped, stream: %d, offset: %.2f\n",
+                st->subno + 1, st->nr_skipped, st->substr, (double)tofs / 90000);
+          }
+        else
+          {
+            fprintf(stderr, "WARN: no subtitles added\n");
+          } /*if*/
+      } /*for*/
+    if (numstreams == 0)
         fprintf(stderr, "WARN: no subtitles added\n");
-      } /*if*/
     if (have_textsub)
       {
         textsub_statistics();
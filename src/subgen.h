@@ -24,6 +24,9 @@ typedef struct { /* representation of a raster image read from a file on disk */
     colorspec pal[256]; /* image colour table */
     int numpal; /* nr used entries in pal */
     int width,height; /* dimensions of image (will be even) */
+    short *colorhash; /* index for looking up colours in pal, only while reading image */
+    uint32_t lastcolor; /* colour of previous pixel read */
+    int lastcolorindex; /* its index into pal, or -1 if none yet */
 } pict;
 
 typedef struct {
@@ -38,6 +41,8 @@ typedef struct { /* representation of a menu button */
     int grp; /* which group button belongs to */
 } button;
 
+typedef struct spucache_entry spucache_entry; /* private to subgen-image */
+
 typedef struct { /* representation of a subpicture and associated buttons */
     unsigned int x0, y0; /* top-left coords of pixels actually present */
     unsigned int xd, yd;
@@ -58,8 +63,23 @@ typedef struct { /* representation of a subpicture and associated buttons */
     int groupmap[3][4]; /* colour table for each button group, -1 for unused entries in each group */
     button *buttons; /* array of buttons */
     subtitle_elt *sub_title; /* subtitle text to be rendered */
+    spucache_entry *cached; /* processed form shared with identical subtitles, if any */
 } stinfo;
 
+typedef struct { /* a subpicture stream to be multiplexed, corresponding to a <stream> tag */
+    int id; /* substream ID (0 .. 31), -1 if not specified */
+    unsigned char substr; /* substream ID as it appears in the MPEG stream */
+    stinfo **spus; /* array of subpictures to insert */
+    int numspus; /* nr entries in spus */
+    unsigned int spuindex; /* index into spus of next one to process */
+    unsigned int workindex; /* index into spus of next one to hand to a worker thread */
+    unsigned char *spustate; /* SPU_xxx processing state of each entry in spus */
+    stinfo *newsti; /* next subpicture due to be inserted */
+    int subno; /* nr of subpictures inserted so far, minus 1 */
+    int nr_skipped; /* nr of subpictures skipped */
+    int header_size; /* PES header size for next packet, including substream ID byte */
+} spustream;
+
 #define SUB_BUFFER_MAX      53220
 #define SUB_BUFFER_HEADROOM     1024
 
@@ -67,10 +87,8 @@ extern unsigned char *sub;
 extern int debug;
 extern bool have_textsub; /* whether a <textsub> tag has been seen */
 
-extern stinfo **spus;
-extern int numspus;
-
-extern int nr_subtitles_skipped;
+extern spustream *streams; /* array */
+extern int numstreams;
 
 int calcY(const colorspec *p);
 int calcCr(const colorspec *p);
@@ -93,5 +111,15 @@ int cvd_encode(stinfo *s);
 // subgen-image
 
 bool process_subtitle(stinfo *s);
+void spucache_share(stinfo *s);
+  /* looks for other subtitles with the same text as s, so they only need to be
+    rendered, processed and encoded once. */
+void spucache_release(stinfo *s);
+  /* called when s is no longer needed, to release its share of any cached form. */
+bool spucache_getpixels(const stinfo *s, unsigned char *data, int *len, int *offset1);
+  /* copies the encoded pixel data saved by spucache_putpixels for an identical
+    subtitle into data, if there is any. Returns true iff found. */
+void spucache_putpixels(const stinfo *s, const unsigned char *data, int len, int offset1);
+  /* saves the encoded pixel data for s, for reuse by identical subtitles. */
 void image_init();
 void image_shutdown();
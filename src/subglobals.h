@@ -55,6 +55,7 @@ extern int subtitle_autoscale; /* fixme: not user-settable */
 extern float subtitle_font_thickness;
 extern colorspec subtitle_fill_color, subtitle_outline_color, subtitle_shadow_color;
 extern int subtitle_shadow_dx, subtitle_shadow_dy;
+extern char *glyph_cache_dir; /* where to keep rendered glyphs between runs, NULL for none */
 
 /* parameters for subrender */
 extern float movie_fps;
@@ -68,8 +69,13 @@ extern int sub_right_margin;
 extern int sub_bottom_margin;
 extern int sub_top_margin;
 /* maintained by subrender: */
-extern unsigned char * textsub_image_buffer; /* where text subtitles are rendered */
+extern unsigned char * textsub_image_buffer;
+  /* where text subtitles are rendered, one byte per pixel, index into textsub_image_pal */
+extern colorspec textsub_image_pal[4]; /* colours for textsub_image_buffer, [0] is transparent */
 extern size_t textsub_image_buffer_size; /* size of buffer */
+extern int textsub_image_x0, textsub_image_y0, textsub_image_x1, textsub_image_y1;
+  /* area of textsub_image_buffer containing the most recently rendered subtitle,
+    x0 and y0 even; everything outside it is transparent */
 
 /* parameters for subgen-image */
 extern bool text_forceit;
@@ -164,32 +164,52 @@ static const char *stristr(const char *haystack, const char *needle)
     Input-file reading
 */
 
+/* The whole subtitle file is read into memory and decoded to UTF-8 in one go,
+  so autodetecting the format only needs to go back to the start of the buffer,
+  and lines can be split off with memchr. */
+
 enum
   {
-    sub_buf_size = 2048,
+    sub_buf_size = 65536, /* initial allocation and read size */
   };
 struct vfile
     subfile;
 static char *
-    sub_buf = NULL;
+    sub_buf = NULL; /* entire decoded contents of file */
 static size_t
-    sub_out_size,
-    sub_next_out,
-    sub_end_out;
-static bool
-    sub_buf_rewindable = false;
+    sub_next_out, /* offset in sub_buf of next byte to return */
+    sub_end_out; /* length of sub_buf contents */
 static int
-    in_charno = 0,
     in_lineno = 1;
 
 static void sub_open(const char * filename)
+  /* opens the specified subtitle file and reads its entire contents into sub_buf. */
   {
+    size_t sub_out_size = sub_buf_size;
     subfile = varied_open(filename, O_RDONLY, "subtitle file");
-    sub_out_size = sub_buf_size;
     sub_buf = malloc(sub_out_size);
-    sub_next_out = 0;
     sub_end_out = 0;
-    in_charno = 0;
+    for (;;)
+      {
+        size_t bytesread;
+        if (sub_buf == NULL)
+          {
+            fprintf(stderr, "ERR:  Out of memory reading subtitle file\n");
+            exit(1);
+          } /*if*/
+        bytesread = fread(sub_buf + sub_end_out, 1, sub_out_size - sub_end_out, subfile.h);
+        sub_end_out += bytesread;
+        if (sub_end_out < sub_out_size)
+            break;
+        sub_out_size *= 2;
+        sub_buf = realloc(sub_buf, sub_out_size);
+      } /*for*/
+    if (ferror(subfile.h))
+      {
+        fprintf(stderr, "ERR:  %d reading subtitle file -- %s\n", errno, strerror(errno));
+        exit(1);
+      } /*if*/
+    sub_next_out = 0;
     in_lineno = 1;
   } /*sub_open*/
 
@@ -204,14 +224,6 @@ static void sub_close(void)
 
 static iconv_t
     icdsc = ICONV_NULL; /* for converting subtitle text encoding to UTF-8 */
-static char
-    ic_inbuf[sub_buf_size]; /* size to minimize reads from disk */
-static size_t
-    ic_next_in,
-    ic_end_in;
-static int
-    ic_needmore,
-    ic_eof;
 
 static void subcp_open(void)
   /* opens an iconv context for converting subtitles from subtitle_charset to UTF-8 if appropriate. */
@@ -222,10 +234,6 @@ static void subcp_open(void)
     if (icdsc != ICONV_NULL)
       {
         fprintf(stderr, "INFO: Opened iconv descriptor. *%s* <= *%s*\n", tocp, fromcp);
-        ic_next_in = 0;
-        ic_end_in = 0;
-        ic_needmore = false;
-        ic_eof = false;
       }
     else
       {
@@ -250,171 +258,69 @@ static void subcp_close(void)
       } /*if*/
   } /*subcp_close*/
 
-#endif /*HAVE_ICONV*/
-
-static int sub_getc()
-  /* gets the next decoded UTF-8 byte from the input file, or EOF if the
-    end of the file has been reached. */
+static void subcp_decode(void)
+  /* converts the entire contents of sub_buf to UTF-8, if an iconv context is open. */
   {
-    int result;
-    if (sub_next_out == sub_end_out)
+    const char * nextin;
+    char * decoded, * nextout;
+    size_t inleft, outleft, decoded_size;
+    if (icdsc == ICONV_NULL)
+        return;
+    decoded_size = sub_end_out * 2 + sub_buf_size; /* enough for most charsets */
+    decoded = malloc(decoded_size);
+    nextin = sub_buf;
+    inleft = sub_end_out;
+    nextout = decoded;
+    outleft = decoded_size;
+    while (inleft != 0)
       {
-#ifdef HAVE_ICONV
-        if (icdsc != ICONV_NULL)
+        if (decoded == NULL)
           {
-            if ((ic_next_in == ic_end_in || ic_needmore) && !ic_eof)
-              {
-              /* refill the input buffer */
-                size_t bytesread;
-                if (ic_next_in < ic_end_in)
-                  {
-                  /* move down remaining unprocessed data from last read */
-                    ic_end_in -= ic_next_in;
-                    memcpy(ic_inbuf, ic_inbuf + ic_next_in, ic_end_in);
-                  }
-                else
-                  {
-                    ic_end_in = 0;
-                  } /*if*/
-                bytesread = fread(ic_inbuf + ic_end_in, 1, sizeof ic_inbuf - ic_end_in, subfile.h);
-                ic_end_in += bytesread;
-                if (ic_end_in < sizeof ic_inbuf)
-                  {
-                    ic_eof = true;
-                  } /*if*/
-                ic_next_in = 0;
-                ic_needmore = false;
-              } /*if*/
-            if (ic_next_in < ic_end_in)
-              {
-              /* refill sub_buf with more decoded characters */
-                const char * nextin;
-                char * nextout;
-                size_t inleft, outleft, prev_sub_end_out;
-                bool convok;
-                nextin = ic_inbuf + ic_next_in;
-                if (sub_buf_rewindable)
-                  {
-                    if (sub_out_size - sub_end_out < sub_buf_size)
-                      {
-                      /* make room for more */
-                        sub_out_size += sub_buf_size;
-                        sub_buf = realloc(sub_buf, sub_out_size);
-                      } /*if*/
-                    nextout = sub_buf + sub_end_out; /* keep what's in buffer */
-                  }
-                else
-                  {
-                    if (sub_out_size > sub_buf_size) /* don't need bigger buffer any more */
-                      {
-                        sub_out_size = sub_buf_size;
-                        sub_buf = realloc(sub_buf, sub_out_size);
-                      } /*if*/
-                    nextout = sub_buf;
-                  } /*if*/
-                inleft = ic_end_in - ic_next_in; /* won't be zero */
-                outleft = sub_out_size - (nextout - sub_buf);
-                prev_sub_end_out = outleft;
-                convok = iconv(icdsc, (char **)&nextin, &inleft, &nextout, &outleft) != (size_t)-1;
-                if (!convok && errno == E2BIG && outleft < prev_sub_end_out)
-                  { /* no room to completely convert input, but got something so that's OK */
-                    convok = true;
-                    errno = 0;
-                  } /*if*/
-                if (!convok)
-                  {
-                    if (!ic_eof && errno == EINVAL)
-                      {
-                        errno = 0;
-                        ic_needmore = true;
-                          /* can't decode what's left in ic_inbuf without reading more */
-                      }
-                    else /* E2BIG (shouldn't occur), EILSEQ, EINVAL at end of file */
-                      {
-                        fprintf
-                          (
-                            stderr,
-                            "ERR:  Error %d -- %s -- decoding subtitle file at approx"
-                                " line pos %d + char pos %d\n",
-                            errno,
-                            strerror(errno),
-                            in_lineno, /* might be wrong */
-                            in_charno + (int)(nextin - ic_inbuf) /* hopefully this is better */
-                          );
-                        exit(1);
-                      } /*if*/
-                  } /*if*/
-                ic_next_in = nextin - ic_inbuf;
-                prev_sub_end_out = sub_buf_rewindable ? sub_end_out : 0;
-                sub_end_out = nextout - sub_buf;
-                assert(sub_end_out != prev_sub_end_out);
-                  /* because I gave it plenty of input data to work on */
-                if (!sub_buf_rewindable)
-                  {
-                    sub_next_out = 0;
-                  } /*if*/
-              } /*if*/
-          }
-        else
-#endif /*HAVE_ICONV*/
+            fprintf(stderr, "ERR:  Out of memory decoding subtitle file\n");
+            exit(1);
+          } /*if*/
+        if (iconv(icdsc, (char **)&nextin, &inleft, &nextout, &outleft) == (size_t)-1)
           {
-            char * nextout;
-            size_t bytesread;
-            if (sub_buf_rewindable)
+            if (errno == E2BIG)
               {
-                if (sub_out_size - sub_end_out < sub_buf_size)
-                  {
-                  /* make room for more */
-                    sub_out_size += sub_buf_size;
-                    sub_buf = realloc(sub_buf, sub_out_size);
-                  } /*if*/
-                nextout = sub_buf + sub_end_out; /* keep what's in buffer */
+              /* make room for more */
+                const size_t used = nextout - decoded;
+                decoded_size *= 2;
+                decoded = realloc(decoded, decoded_size);
+                nextout = decoded + used;
+                outleft = decoded_size - used;
               }
-            else
+            else /* EILSEQ, EINVAL at end of file */
               {
-                if (sub_out_size > sub_buf_size) /* don't need bigger buffer any more */
-                  {
-                    sub_out_size = sub_buf_size;
-                    sub_buf = realloc(sub_buf, sub_out_size);
-                  } /*if*/
-                nextout = sub_buf;
-              } /*if*/
-            if (!sub_buf_rewindable)
-              {
-                sub_end_out = 0;
-                sub_next_out = 0;
+                const char *p;
+                int lineno = 1;
+                for (p = decoded; p < nextout; ++p)
+                    if (*p == '\n')
+                        ++lineno;
+                fprintf
+                  (
+                    stderr,
+                    "ERR:  Error %d -- %s -- decoding subtitle file at line %d, byte offset %ld\n",
+                    errno,
+                    strerror(errno),
+                    lineno,
+                    (long)(nextin - sub_buf)
+                  );
+                exit(1);
               } /*if*/
-            bytesread = fread(nextout, 1, sub_out_size - sub_end_out, subfile.h);
-            sub_end_out += bytesread;
-          } /*if*/
-      } /*if*/
-    if (sub_next_out < sub_end_out)
-      {
-        result = sub_buf[sub_next_out];
-        ++in_charno;
-        ++sub_next_out;
-        if (result == '\n')
-          {
-            ++in_lineno;
           } /*if*/
-      }
-    else
-      {
-        result = EOF;
-      } /*if*/
-    return result;
-  } /*sub_getc*/
+      } /*while*/
+    free(sub_buf);
+    sub_buf = decoded;
+    sub_end_out = nextout - decoded;
+  } /*subcp_decode*/
+
+#endif /*HAVE_ICONV*/
 
 static void sub_rewind()
   /* rewinds to the beginning of the input subtitle file. */
   {
-    if (!sub_buf_rewindable)
-      {
-        fprintf(stderr, "ERR:  trying to rewind subtitle file when not in rewindable state\n");
-        exit(1);
-      } /*if*/
     sub_next_out = 0;
-    in_charno = 0;
     in_lineno = 1;
   } /*sub_rewind*/
 
@@ -424,40 +330,25 @@ static char * sub_fgets
     size_t dstsize /* must be at least 1, probably should be at least 2 */
   )
   /* reads a whole line from the input subtitle file into dst, returning dst if
-    at least one character was read. */
+    at least one character was read. Overlong lines are truncated to fit. */
   {
-    const char * dstend = dst + dstsize - 1;
-    char * dstnext = dst;
-    bool warned_truncated = false;
-    for (;;)
+    const char * const line = sub_buf + sub_next_out;
+    const char * const eol = memchr(line, '\n', sub_end_out - sub_next_out);
+    const size_t linelen = eol != NULL ? eol - line + 1 : sub_end_out - sub_next_out;
+      /* including newline, if any */
+    size_t copylen = linelen;
+    if (linelen == 0)
+        return NULL; /* end of file */
+    if (copylen > dstsize - 1)
       {
-        const int nextch = sub_getc();
-        if (nextch == EOF)
-          {
-            if (dstnext == dst)
-              {
-                dst = NULL; /* indicate nothing read */
-              } /*if*/
-            break;
-          } /*if*/
-        if (dstnext < dstend)
-          {
-            *dstnext = nextch;
-            ++dstnext;
-          }
-        else if (!warned_truncated)
-          {
-            fprintf(stderr, "WARN: input subtitle line too long on line %d\n", in_lineno);
-            warned_truncated = true;
-          /* and continue gobbling rest of line */
-          } /*if*/
-        if (nextch == '\n')
-            break; /* end of line */
-      } /*for*/
-    if (dst != NULL)
-      {
-        *dstnext = 0; /* terminating null */
+        fprintf(stderr, "WARN: input subtitle line too long on line %d\n", in_lineno);
+        copylen = dstsize - 1;
       } /*if*/
+    memcpy(dst, line, copylen);
+    dst[copylen] = 0; /* terminating null */
+    sub_next_out += linelen;
+    if (eol != NULL)
+        ++in_lineno;
     return dst;
   } /*sub_fgets*/
 
@@ -546,8 +437,8 @@ subtitle_elt *sub_read_line_sami(subtitle_elt *current)
   /* yuk--internal static state */
     static char line[LINE_LEN + 1];
     static const char *s = NULL;
-  /* to get rid of above, simply use sub_getc and process input one character
-    at a time, rather than a whole line at a time */
+  /* to get rid of above, simply process input one character at a time, rather
+    than a whole line at a time */
     char text[LINE_LEN + 1], *p = text;
     const char *q;
     int state;
@@ -1921,6 +1812,29 @@ static void adjust_subs_time
         fprintf(stderr, "INFO: Adjusted %d subtitle(s).\n", nradjusted);
   } /*adjust_subs_time*/
 
+#ifdef USE_SORTSUB
+
+static int compare_sub_start(const void *a, const void *b)
+  /* sort comparator for pointers to subtitle entries: orders them by start time,
+    keeping entries with equal start times in their original order. */
+  {
+    const subtitle_elt * const sa = *(const subtitle_elt * const *)a;
+    const subtitle_elt * const sb = *(const subtitle_elt * const *)b;
+    return
+        sa->start < sb->start ?
+            -1
+        : sa->start > sb->start ?
+            1
+        : sa < sb ?
+            -1
+        : sa > sb ?
+            1
+        :
+            0;
+  } /*compare_sub_start*/
+
+#endif
+
 struct subreader { /* describes a subtitle format */
     subtitle_elt * (*read)(subtitle_elt *dest); /* file reader routine */
     void       (*post)(subtitle_elt *dest); /* optional post-processor routine */
@@ -1940,7 +1854,8 @@ sub_data *sub_read_file(const char *filename, float movie_fps)
     int n_max;
     subtitle_elt *first, *second, *new_sub, *return_sub;
 #ifdef USE_SORTSUB
-    subtitle_elt temp_sub;
+    bool sorted = true; /* whether entries read so far are in order of start time */
+    int last = -1; /* index of entry read so far that sorts last */
 #endif
     sub_data *subt_data;
     bool uses_time = false;
@@ -1984,10 +1899,12 @@ sub_data *sub_read_file(const char *filename, float movie_fps)
                   } /*if; for*/
           } /*if*/
         if (k < 0) /* assume it's not UTF-8 */
+          {
             subcp_open(); /* to convert the text to UTF-8 */
+            subcp_decode();
+          } /*if*/
       }
 #endif
-    sub_buf_rewindable = true;
     sub_format = sub_autodetect(&uses_time);
     mpsub_multiplier = (uses_time ? 100.0 : 1.0);
     if (sub_format == SUB_INVALID)
@@ -1998,7 +1915,6 @@ sub_data *sub_read_file(const char *filename, float movie_fps)
     srp = sr + sub_format;
     fprintf(stderr, "INFO: Detected subtitle file format: %s\n", srp->name);
     sub_rewind();
-    sub_buf_rewindable = false;
     sub_num = 0;
     n_max = 32; /* initial size of "first" array */
     first = (subtitle_elt *)malloc(n_max * sizeof(subtitle_elt));
@@ -2020,16 +1936,11 @@ sub_data *sub_read_file(const char *filename, float movie_fps)
       /* read subtitle entries from input file */
         if (sub_num == n_max) /* need more room in "first" array */
           {
-            n_max += 16;
+            n_max *= 2;
             first = realloc(first, n_max * sizeof(subtitle_elt));
           } /*if*/
-#ifdef USE_SORTSUB
-        new_sub = &temp_sub;
-          /* temporary holding area before copying entry into right place in first array */
-#else
         new_sub = &first[sub_num];
-          /* just put it directly on the end */
-#endif
+          /* just put it directly on the end, sorting is done afterwards */
         memset(new_sub, '\0', sizeof(subtitle_elt));
         new_sub = srp->read(new_sub);
         if (!new_sub)
@@ -2055,59 +1966,39 @@ sub_data *sub_read_file(const char *filename, float movie_fps)
         if (new_sub != ERR && !sub_no_text_pp && srp->post)
             srp->post(new_sub);
 #ifdef USE_SORTSUB
-      /* fixme: this will all crash if new_sub == ERR */
-        if (!sub_num || first[sub_num - 1].start <= new_sub->start)
+        if (last < 0 || first[last].start <= new_sub->start)
           {
-          /* append contents of new_sub to first */
-            int i;
-            first[sub_num].start = new_sub->start;
-            first[sub_num].end = new_sub->end;
-            first[sub_num].lines = new_sub->lines;
-            first[sub_num].alignment = new_sub->alignment;
-            for (i = 0; i < new_sub->lines; ++i)
-              {
-                first[sub_num].text[i] = new_sub->text[i];
-              }/*for*/
-            if (previous_sub_end)
-              {
-                first[sub_num - 1].end = previous_sub_end;
-                previous_sub_end = 0;
-              } /*if*/
+          /* new entry sorts after all previous ones */
+            if (previous_sub_end && last >= 0)
+                first[last].end = previous_sub_end;
+            last = sub_num;
           }
         else
           {
-          /* insert new_sub into first to keep it sorted by start time */
-            int i, j;
-            for (j = sub_num - 1; j >= 0; --j)
+          /* out of order, will need sorting afterwards */
+            sorted = false;
+            if (previous_sub_end)
               {
-                first[j + 1].start = first[j].start;
-                first[j + 1].end = first[j].end;
-                first[j + 1].lines = first[j].lines;
-                first[j + 1].alignment = first[j].alignment;
-                for (i = 0; i < first[j].lines; ++i)
-                  {
-                    first[j + 1].text[i] = first[j].text[i];
-                  } /*for*/
-                if (!j || first[j - 1].start <= new_sub->start)
+              /* find the entry that the new one will end up following, and
+                make it end when the new one starts, giving the new one its
+                previous end time */
+                int pred = -1, j;
+                for (j = 0; j < sub_num; ++j)
+                    if
+                      (
+                            first[j].start <= new_sub->start
+                        &&
+                            (pred < 0 || first[j].start >= first[pred].start)
+                      )
+                        pred = j;
+                if (pred >= 0)
                   {
-                    first[j].start = new_sub->start;
-                    first[j].end = new_sub->end;
-                    first[j].lines = new_sub->lines;
-                    first[j].alignment = new_sub->alignment;
-                    for (i = 0; i < SUB_MAX_TEXT; ++i)
-                      {
-                        first[j].text[i] = new_sub->text[i];
-                      } /*for*/
-                    if (previous_sub_end)
-                      {
-                        first[j].end = first[j - 1].end;
-                        first[j - 1].end = previous_sub_end;
-                        previous_sub_end = 0;
-                      } /*if*/
-                    break;
+                    new_sub->end = first[pred].end;
+                    first[pred].end = previous_sub_end;
                   } /*if*/
-              } /*for*/
+              } /*if*/
           } /*if*/
+        previous_sub_end = 0;
 #endif
         if (new_sub == ERR)
             ++sub_errs;
@@ -2118,6 +2009,23 @@ sub_data *sub_read_file(const char *filename, float movie_fps)
     subcp_close();
 #endif
     sub_close();
+#ifdef USE_SORTSUB
+    if (!sorted)
+      {
+      /* put entries into order of start time in one go */
+        subtitle_elt ** const order = malloc(sub_num * sizeof(subtitle_elt *));
+        subtitle_elt * const sorted_subs = malloc(n_max * sizeof(subtitle_elt));
+        int i;
+        for (i = 0; i < sub_num; ++i)
+            order[i] = first + i;
+        qsort(order, sub_num, sizeof(subtitle_elt *), compare_sub_start);
+        for (i = 0; i < sub_num; ++i)
+            sorted_subs[i] = *order[i];
+        free(order);
+        free(first);
+        first = sorted_subs;
+      } /*if*/
+#endif
 //  fprintf(stderr, "SUB: Subtitle format %s time.\n", uses_time ? "uses" : "doesn't use");
     fprintf(stderr, "INFO: Read %i subtitles\n", sub_num);
     if (sub_errs)
@@ -46,6 +46,23 @@ typedef struct mp_osd_bbox_s
 #define MAX_UCS 1600
 #define MAX_UCSLINES 16
 
+// Structures needed for the new splitting algorithm.
+// osd_text_word contains the single subtitle word.
+// osd_text_line is used to mark the lines of subtitles
+typedef struct
+  {
+    int osd_kerning; //kerning with the previous word
+    int osd_length;  //horizontal length inside the bbox
+    int text_start;  //index of first character in layout chars
+    int text_length; //number of characters
+  } osd_text_word;
+
+typedef struct
+  {
+    int linewidth;
+    int words; /* index of first word on this line; it ends where the next line starts */
+  } osd_text_line;
+
 typedef struct /* for holding and maintaining a rendered subtitle image */
   {
     int topy;
@@ -61,7 +78,14 @@ typedef struct /* for holding and maintaining a rendered subtitle image */
       } params;
     int stride; /* bytes per row of both alpha and bitmap buffers */
     int allocated; /* size in bytes of each buffer */
-    unsigned char *bitmap_buffer; /* four bytes per pixel */
+    unsigned char *bitmap_buffer; /* one byte per pixel, index into textsub_image_pal */
+    struct /* working storage for laying out text, kept for reuse from one subtitle to the next */
+      {
+        int *chars; /* characters of all words, one after the other */
+        osd_text_word *words; /* all words on all lines, in order */
+        osd_text_line *lines; /* all display lines, in order */
+        int allocated; /* nr entries allocated in each of the above */
+      } layout;
   } mp_osd_obj_t;
 
 static int sub_pos=100;
@@ -81,6 +105,8 @@ int movie_height = 0;
 
 unsigned char *textsub_image_buffer;
 size_t textsub_image_buffer_size;
+colorspec textsub_image_pal[4];
+int textsub_image_x0, textsub_image_y0, textsub_image_x1, textsub_image_y1;
 
 /* statistics */
 int sub_max_chars;
@@ -105,16 +131,7 @@ static inline void vo_draw_subtitle_line
     int y;
     for (y = 0; y < h; y++)
       {
-        const register unsigned char * src = srcbase;
-        register unsigned char * dst = dstbase;
-        register int x;
-        for (x = 0; x < w; x++)
-          {
-            *dst++ = *src++;
-            *dst++ = *src++;
-            *dst++ = *src++;
-            *dst++ = *src++;
-          } /*for*/
+        memcpy(dstbase, srcbase, w);
         srcbase += srcstride;
         dstbase += dststride;
       } /*for*/
@@ -123,28 +140,20 @@ static inline void vo_draw_subtitle_line
 static void draw_glyph
   (
     mp_osd_obj_t * obj,
-    int x0, /* origin in destination buffer to copy to */
+    int x0, /* origin of character cell in destination buffer */
     int y0,
-    int w, /* dimensions of area to copy */
+    int w, /* dimensions of area of character cell to copy */
     int h,
-    const unsigned char * src, /* source pixels */
-    const colorspec * srccolors, /* source palette */
-    int stride /* of source */
+    const glyph_image * image, /* source pixels */
+    const colorspec * srccolors /* source palette */
   )
   /* used to assemble complete rendered screen lines in obj by copying individual
-    glyph images. */
+    glyph images. The glyph colour indexes are kept as they are; all glyphs
+    share the same four colours, which are saved in textsub_image_pal. Only
+    the part of the cell actually covered by the glyph image is visited. */
   {
-    int dststride = obj->stride;
-    int dstskip = obj->stride - w * 4;
-    int srcskip = stride - w;
-    int i, j;
-    unsigned char * bdst =
-            obj->bitmap_buffer
-        +
-            (y0 - obj->bbox.y1) * dststride
-        +
-            (x0 - obj->bbox.x1) * 4;
-    const unsigned char * bsrc = src;
+    const int dststride = obj->stride;
+    int i, j, iw, ih;
   /* fprintf(stderr, "***w:%d x0:%d bbx1:%d bbx2:%d dstsstride:%d y0:%d h:%d bby1:%d bby2:%d ofs:%d ***\n",w,x0,obj->bbox.x1,obj->bbox.x2,dststride,y0,h,obj->bbox.y1,obj->bbox.y2,(y0-obj->bbox.y1)*dststride + (x0-obj->bbox.x1));*/
     if (x0 < obj->bbox.x1 || x0 + w > obj->bbox.x2 || y0 < obj->bbox.y1 || y0 + h > obj->bbox.y2)
       {
@@ -157,25 +166,27 @@ static void draw_glyph
           );
         return;
       } /*if*/
-    for (i = 0; i < h; i++)
+    memcpy(textsub_image_pal, srccolors, sizeof textsub_image_pal);
+    iw = image->left + image->width <= w ? image->width : w - image->left;
+    ih = image->top + image->height <= h ? image->height : h - image->top;
+    for (i = 0; i < ih; i++)
       {
-        for (j = 0; j < w; j++)
+        const unsigned char * bsrc = image->pixels + i * image->width;
+        unsigned char * bdst =
+                obj->bitmap_buffer
+            +
+                (y0 + image->top + i - obj->bbox.y1) * dststride
+            +
+                (x0 + image->left - obj->bbox.x1);
+        for (j = 0; j < iw; j++)
           {
-            const colorspec srccolor = srccolors[*bsrc++];
-            if (srccolor.a != 0)
-              {
-                *bdst++ = srccolor.r;
-                *bdst++ = srccolor.g;
-                *bdst++ = srccolor.b;
-                *bdst++ = srccolor.a;
-              }
-            else
+            const unsigned char srcindex = *bsrc++;
+            if (srccolors[srcindex].a != 0)
               {
-                bdst += 4;
+                *bdst = srcindex;
               } /*if*/
+            bdst++;
           } /*for*/
-        bdst += dstskip;
-        bsrc += srcskip;
       } /*for*/
   } /*draw_glyph*/
 
@@ -188,7 +199,7 @@ static void alloc_buf(mp_osd_obj_t * obj)
         obj->bbox.x2 = obj->bbox.x1;
     if (obj->bbox.y2 < obj->bbox.y1)
         obj->bbox.y2 = obj->bbox.y1;
-    obj->stride = (obj->bbox.x2 - obj->bbox.x1) * 4 + 7 & ~7; /* round up to multiple of 8 bytes--why bother? */
+    obj->stride = (obj->bbox.x2 - obj->bbox.x1) + 7 & ~7; /* round up to multiple of 8 bytes--why bother? */
     len = obj->stride * (obj->bbox.y2 - obj->bbox.y1);
     if (obj->allocated < len)
       {
@@ -208,23 +219,6 @@ inline static void vo_update_text_sub
   /* lays out and renders the subtitle text from the_sub using the font settings from vo_font,
     putting the results into obj. */
   {
-    // Structures needed for the new splitting algorithm.
-    // osd_text_word contains the single subtitle word.
-    // osd_text_line is used to mark the lines of subtitles
-    struct osd_text_word
-      {
-        int osd_kerning; //kerning with the previous word
-        int osd_length;  //horizontal length inside the bbox
-        int text_length; //number of characters
-        int *text;       //characters
-        struct osd_text_word *prev, *next; /* doubly-linked list of all words on all lines */
-      };
-    struct osd_text_line
-      {
-        int linewidth;
-        struct osd_text_word *words; /* where in word list this line starts */
-        struct osd_text_line *prev, *next; /* doubly-linked list */
-      };
     int linedone, linesleft;
     bool warn_overlong_word;
     int textlen, sub_totallen;
@@ -249,28 +243,51 @@ inline static void vo_update_text_sub
       /* actually a waste of time computing this when I don't allow mixing fonts */
     linesleft = the_sub->lines;
       {
-        struct osd_text_line
-          // these are used to store the whole sub text osd
-            *otp_sub = NULL, /* head of list */
-            *otp_sub_last = NULL; /* last element of list */
-        int *wordbuf = NULL;
+        int *chars;
+        osd_text_word *words;
+        osd_text_line *lines;
+        int nrchars = 0, nrwords = 0, nrlines = 0;
+          {
+          /* make sure layout arrays are big enough: there cannot be more characters
+            than bytes of text, nor more words (or display lines) than one per
+            character plus one per line */
+            int needed = 0, i;
+            for (i = 0; i < the_sub->lines; i++)
+                needed += strlen(the_sub->text[i]) + 1;
+            if (obj->layout.allocated < needed)
+              {
+                do
+                    obj->layout.allocated = obj->layout.allocated != 0 ? obj->layout.allocated * 2 : 256;
+                while (obj->layout.allocated < needed);
+                free(obj->layout.chars);
+                free(obj->layout.words);
+                free(obj->layout.lines);
+                obj->layout.chars = malloc(obj->layout.allocated * sizeof(int));
+                obj->layout.words = malloc(obj->layout.allocated * sizeof(osd_text_word));
+                obj->layout.lines = malloc(obj->layout.allocated * sizeof(osd_text_line));
+                if (obj->layout.chars == NULL || obj->layout.words == NULL || obj->layout.lines == NULL)
+                  {
+                    fprintf(stderr, "ERR:  Failed to allocate memory\n");
+                    exit(1);
+                  } /*if*/
+              } /*if*/
+          }
+        chars = obj->layout.chars;
+        words = obj->layout.words;
+        lines = obj->layout.lines;
         while (linesleft)
           { /* split next subtitle line into words */
-            struct osd_text_word
-                *osl, /* head of list */
-                *osl_tail; /* last element of list */
-            int chindex, prevch, wordlen;
+            const int firstword = nrwords, firstline = nrlines;
+              /* where words and display lines for this subtitle line start */
+            int chindex, prevch, wordstart;
             const unsigned char *text;
             int xsize = -vo_font->charspace;
               /* cancels out extra space left before first word of line */
             linesleft--;
             text = (const unsigned char *)the_sub->text[linedone++];
             textlen = strlen((const char *)text);
-            wordlen = 0;
-            wordbuf = (int *)realloc(wordbuf, textlen * sizeof(int));
+            wordstart = nrchars;
             prevch = -1;
-            osl = NULL;
-            osl_tail = NULL;
             warn_overlong_word = true;
             // reading the subtitle words from the_sub->text[]
             chindex = 0;
@@ -289,6 +306,12 @@ inline static void vo_update_text_sub
                           {
                             curch = (((curch & 0x0f) << 6) | (text[++chindex] & 0x3f)) << 6;
                             curch |= text[++chindex] & 0x3f;
+                          }
+                        else if ((curch & 0xf8) == 0xf0) /* 4 bytes U+10000..U+10FFFF */
+                          {
+                            curch = (((curch & 0x07) << 6) | (text[++chindex] & 0x3f)) << 6;
+                            curch = (curch | (text[++chindex] & 0x3f)) << 6;
+                            curch |= text[++chindex] & 0x3f;
                           } /*if*/
                       } /*if*/
                     if (sub_totallen == MAX_UCS)
@@ -303,28 +326,16 @@ inline static void vo_update_text_sub
                 if (chindex >= textlen || curch == ' ')
                   {
                   /* word break */
-                    struct osd_text_word * const newelt =
-                        (struct osd_text_word *)calloc(1, sizeof(struct osd_text_word));
-                    int counter;
-                    if (osl == NULL)
-                      {
-                      /* first element on list */
-                        osl = newelt;
-                      }
-                    else
-                      {
-                      /* link to previous elements */
-                        newelt->prev = osl_tail;
-                        osl_tail->next = newelt;
-                        newelt->osd_kerning = vo_font->charspace + vo_font->width[' '];
-                      } /*if*/
-                    osl_tail = newelt;
+                    osd_text_word * const newelt = words + nrwords++;
+                    newelt->osd_kerning =
+                        newelt == words + firstword ?
+                            0 /* first word on line */
+                        :
+                            vo_font->charspace + get_font_char(vo_font, ' ')->width;
                     newelt->osd_length = xsize;
-                    newelt->text_length = wordlen;
-                    newelt->text = (int *)malloc(wordlen * sizeof(int));
-                    for (counter = 0; counter < wordlen; ++counter)
-                        newelt->text[counter] = wordbuf[counter];
-                    wordlen = 0;
+                    newelt->text_start = wordstart;
+                    newelt->text_length = nrchars - wordstart;
+                    wordstart = nrchars;
                     if (chindex == textlen)
                         break;
                     xsize = 0;
@@ -334,7 +345,7 @@ inline static void vo_update_text_sub
                   {
                   /* continue accumulating word */
                     const int delta_xsize =
-                            vo_font->width[curch]
+                            get_font_char(vo_font, curch)->width
                         +
                             vo_font->charspace
                         +
@@ -346,12 +357,12 @@ inline static void vo_update_text_sub
                         if (!warn_overlong_word)
                             warn_overlong_word = true;
                         prevch = curch;
-                        wordbuf[wordlen++] = curch;
+                        chars[nrchars++] = curch;
                         xsize += delta_xsize;
                         if (!suboverlap_enabled)
                           {
                           /* keep track of line heights to ensure no overlap */
-                            const int font = vo_font->font[curch];
+                            const int font = get_font_char(vo_font, curch)->font;
                             if (font >= 0 && vo_font->pic_b[font]->h > max_line_height)
                               {
                                 max_line_height = vo_font->pic_b[font]->h;
@@ -370,49 +381,43 @@ inline static void vo_update_text_sub
                   } /*if*/
                 ++chindex;
               } /*for*/
-        // osl holds an ordered (as they appear in the lines) chain of the subtitle words
-            if (osl != NULL) /* will always be true! */
+        // words[firstword .. nrwords - 1] hold the subtitle words of this line in order
               {
               /* collect words of this line into one or more on-screen lines,
                 wrapping too-long lines */
                 int linewidth = 0, linewidth_variation = 0;
-                struct osd_text_line *lastnewelt;
-                struct osd_text_word *curword;
-                struct osd_text_line *otp_new;
-                // otp_new will contain the chain of the osd subtitle lines coming from the single the_sub line.
-                otp_new = lastnewelt = (struct osd_text_line *)calloc(1, sizeof(struct osd_text_line));
-                lastnewelt->words = osl;
+                int curword;
+                osd_text_line *lastnewelt;
+                // lines[firstline .. nrlines - 1] will contain the osd subtitle lines coming from the single the_sub line.
+                lastnewelt = lines + nrlines++;
+                lastnewelt->words = firstword;
                 curword = lastnewelt->words;
                 for (;;)
                   {
                     while
                       (
-                            curword != NULL
+                            curword < nrwords
                         &&
-                            linewidth + curword->osd_kerning + curword->osd_length <= widthlimit
+                            linewidth + words[curword].osd_kerning + words[curword].osd_length <= widthlimit
                       )
                       {
                       /* include another word on this line */
-                        linewidth += curword->osd_kerning + curword->osd_length;
-                        curword = curword->next;
+                        linewidth += words[curword].osd_kerning + words[curword].osd_length;
+                        ++curword;
                       } /*while*/
                     if
                       (
-                            curword != NULL
+                            curword < nrwords
                         &&
                             curword != lastnewelt->words
                               /* ensure new line contains at least one word (fix Ubuntu bug 385187) */
                       )
                       {
-                      /* append yet another new display line onto otp_new chain */
-                        struct osd_text_line * const nextnewelt =
-                            (struct osd_text_line *)calloc(1, sizeof(struct osd_text_line));
+                      /* append yet another new display line */
                         lastnewelt->linewidth = linewidth;
-                        lastnewelt->next = nextnewelt;
-                        nextnewelt->prev = lastnewelt;
-                        lastnewelt = nextnewelt;
+                        lastnewelt = lines + nrlines++;
                         lastnewelt->words = curword;
-                        linewidth = -2 * vo_font->charspace - vo_font->width[' '];
+                        linewidth = -2 * vo_font->charspace - get_font_char(vo_font, ' ')->width;
                       }
                     else
                       {
@@ -426,18 +431,12 @@ inline static void vo_update_text_sub
                 // linewidth_variation holds the 'sum of the differences in length among the lines',
                 // a measure of the eveness of the lengths of the lines
                   {
-                    struct osd_text_line *tmp_otp;
-                    for (tmp_otp = otp_new; tmp_otp->next != NULL; tmp_otp = tmp_otp->next)
-                      {
-                        const struct osd_text_line * pmt = tmp_otp->next;
-                        while (pmt != NULL)
-                          {
-                            linewidth_variation += abs(tmp_otp->linewidth - pmt->linewidth);
-                            pmt = pmt->next;
-                          } /*while*/
-                      } /*for*/
+                    int i, j;
+                    for (i = firstline; i < nrlines - 1; i++)
+                        for (j = i + 1; j < nrlines; j++)
+                            linewidth_variation += abs(lines[i].linewidth - lines[j].linewidth);
                   }
-                if (otp_new->next != NULL) /* line split into more than one display line */
+                if (nrlines - firstline > 1) /* line split into more than one display line */
                   {
                     // until the last word of a line can be moved to the beginning of following line
                     // reducing the 'sum of the differences in length among the lines', it is done
@@ -445,151 +444,85 @@ inline static void vo_update_text_sub
                       /* even out variations in width of screen lines corresponding to
                         a single subtitle line */
                       {
-                        struct osd_text_line *this_display_line;
-                        bool exit1 = true; /* initial assumption */
-                        struct osd_text_line *rebalance_line = NULL;
-                          /* if non-null, then word at end of this line should be moved to
+                        int this_display_line;
+                        int rebalance_line = -1;
+                          /* if not -1, then word at end of this line should be moved to
                             following line */
                         for
                           (
-                            this_display_line = otp_new;
-                            this_display_line->next != NULL;
-                            this_display_line = this_display_line->next
+                            this_display_line = firstline;
+                            this_display_line < nrlines - 1;
+                            this_display_line++
                           )
                           {
-                            struct osd_text_line *next_display_line = this_display_line->next;
-                            struct osd_text_word *prev_word;
-                            for
-                              (
-                                prev_word = this_display_line->words;
-                                prev_word->next != next_display_line->words;
-                                prev_word = prev_word->next
-                              )
-                              /* find predecessor word to next_display_line */;
-                              /* seems a shame I can't make use of the doubly-linked lists
-                                somehow to speed this up */
+                            osd_text_line * const this_line = lines + this_display_line;
+                            osd_text_line * const next_line = this_line + 1;
+                            const osd_text_word * const prev_word = words + next_line->words - 1;
+                              /* last word on this_line */
                             if
                               (
-                                        next_display_line->linewidth
+                                        next_line->linewidth
                                     +
                                         prev_word->osd_length
                                     +
-                                        next_display_line->words->osd_kerning
+                                        words[next_line->words].osd_kerning
                                 <=
                                     widthlimit
                               )
                               {
-                              /* prev_word can be moved from this_display_line line onto
-                                next_display_line line; see if doing this improves the layout */
-                                struct osd_text_line *that_display_line;
-                                int new_variation;
+                              /* prev_word can be moved from this_line onto next_line;
+                                see if doing this improves the layout */
+                                int new_variation, i, j;
                                 int prev_line_width, cur_line_width;
-                                prev_line_width = this_display_line->linewidth;
-                                cur_line_width = next_display_line->linewidth;
+                                prev_line_width = this_line->linewidth;
+                                cur_line_width = next_line->linewidth;
                               /* temporary change to line widths to see effect of new layout */
-                                this_display_line->linewidth =
+                                this_line->linewidth =
                                         prev_line_width
                                     -
                                         prev_word->osd_length
                                     -
                                         prev_word->osd_kerning;
-                                next_display_line->linewidth =
+                                next_line->linewidth =
                                         cur_line_width
                                     +
                                         prev_word->osd_length
                                     +
-                                        next_display_line->words->osd_kerning;
+                                        words[next_line->words].osd_kerning;
                                 new_variation = 0;
-                                for
-                                  (
-                                    that_display_line = otp_new;
-                                    that_display_line->next != NULL;
-                                    that_display_line = that_display_line->next
-                                  )
-                                  {
-                                    next_display_line = that_display_line->next;
-                                    while (next_display_line != NULL)
-                                      {
-                                        new_variation +=
-                                            abs
-                                              (
-                                                    that_display_line->linewidth
-                                                -
-                                                    next_display_line->linewidth
-                                              );
-                                        next_display_line = next_display_line->next;
-                                      } /*while*/
-                                  } /*for*/
+                                for (i = firstline; i < nrlines - 1; i++)
+                                    for (j = i + 1; j < nrlines; j++)
+                                        new_variation += abs(lines[i].linewidth - lines[j].linewidth);
                                 if (new_variation < linewidth_variation)
                                   {
                                   /* implement this new layout unless I find something better */
                                     linewidth_variation = new_variation;
                                     rebalance_line = this_display_line;
-                                    exit1 = false;
                                   } /*if*/
                               /* undo the temporary line width changes */
-                                this_display_line->linewidth = prev_line_width;
-                                this_display_line->next->linewidth = cur_line_width;
+                                this_line->linewidth = prev_line_width;
+                                next_line->linewidth = cur_line_width;
                               } /*if*/
                           } /*for*/
                         // merging
-                        if (exit1) /* no improvement found */
+                        if (rebalance_line < 0) /* no improvement found */
                             break;
                           {
                           /* word at end of rebalance_line line should be moved to following line */
-                            struct osd_text_word *word_to_move;
-                            struct osd_text_line *next_display_line;
-                            this_display_line = rebalance_line;
-                            next_display_line = this_display_line->next;
-                            for
-                              (
-                                word_to_move = this_display_line->words;
-                                word_to_move->next != next_display_line->words;
-                                word_to_move = word_to_move->next
-                              )
-                              /* find previous word to be moved to this line */;
-                              /* seems a shame I can't make use of the doubly-linked lists
-                                somehow to speed this up, not to mention having to do
-                                it twice */
-                            this_display_line->linewidth -=
+                            osd_text_line * const this_line = lines + rebalance_line;
+                            osd_text_line * const next_line = this_line + 1;
+                            const osd_text_word * const word_to_move = words + next_line->words - 1;
+                            this_line->linewidth -=
                                 word_to_move->osd_length + word_to_move->osd_kerning;
-                            next_display_line->linewidth +=
-                                word_to_move->osd_length + next_display_line->words->osd_kerning;
-                            next_display_line->words = word_to_move;
+                            next_line->linewidth +=
+                                word_to_move->osd_length + words[next_line->words].osd_kerning;
+                            next_line->words--;
                           } //~merging
                       } /*for*/
-                  } //~if (otp->next != NULL)
+                  } //~if (nrlines - firstline > 1)
 #endif
-                // adding otp (containing splitted lines) to otp chain
-                if (otp_sub == NULL)
-                  {
-                    otp_sub = otp_new;
-                    for
-                      (
-                        otp_sub_last = otp_sub;
-                        otp_sub_last->next != NULL;
-                        otp_sub_last = otp_sub_last->next
-                      )
-                      /* find last element in chain */;
-                  }
-                else
-                  {
-                  /* append otp_new to otp_sub chain */
-                    struct osd_text_word * ott_last = otp_sub->words;
-                    while (ott_last->next != NULL)
-                        ott_last = ott_last->next;
-                    ott_last->next = otp_new->words;
-                    otp_new->words->prev = ott_last;
-                    //attaching new subtitle line at the end
-                    otp_sub_last->next = otp_new;
-                    otp_new->prev = otp_sub_last;
-                    do
-                        otp_sub_last = otp_sub_last->next;
-                    while (otp_sub_last->next != NULL);
-                  } /*if*/
-              } //~ if (osl != NULL)
+              }
           } // while (linesleft)
-        free(wordbuf);
         // write lines into utbl
         xtblc = 0; /* count of display lines */
         utblc = 0; /* total count of characters in all display lines */
@@ -598,15 +531,10 @@ inline static void vo_update_text_sub
           {
           /* collect display line text into obj->params.subtitle.utbl and x-positions
             into obj->params.subtitle.xtbl */
-            struct osd_text_line *this_display_line;
-            for
-              (
-                this_display_line = otp_sub;
-                this_display_line != NULL;
-                this_display_line = this_display_line->next
-              )
+            int this_display_line;
+            for (this_display_line = 0; this_display_line < nrlines; this_display_line++)
               {
-                struct osd_text_word *this_word, *next_line_words;
+                int this_word, next_line_words;
                 int xsize;
                 if (obj->params.subtitle.lines++ >= MAX_UCSLINES)
                   {
@@ -621,7 +549,7 @@ inline static void vo_update_text_sub
                       /* discard overlong line */
                     break;
                   } /*if*/
-                xsize = this_display_line->linewidth;
+                xsize = lines[this_display_line].linewidth;
                 obj->params.subtitle.xtbl[xtblc++] = (widthlimit - xsize) / 2 + sub_left_margin;
                 if (xmin > (widthlimit - xsize) / 2 + sub_left_margin)
                     xmin = (widthlimit - xsize) / 2 + sub_left_margin;
@@ -629,27 +557,28 @@ inline static void vo_update_text_sub
                     xmax = (widthlimit + xsize) / 2 + sub_left_margin;
              /* fprintf(stderr, "lm %d rm: %d xm:%d xs:%d\n", sub_left_margin, sub_right_margin, xmax, xsize); */
                 next_line_words =
-                    this_display_line->next == NULL ?
-                        NULL
+                    this_display_line + 1 == nrlines ?
+                        nrwords
                     :
-                        this_display_line->next->words;
+                        lines[this_display_line + 1].words;
                 for
                   (
-                    this_word = this_display_line->words;
+                    this_word = lines[this_display_line].words;
                     this_word != next_line_words;
-                    this_word = this_word->next
+                    this_word++
                   )
                   {
                   /* assemble display lines into obj->params.subtitle */
+                    const int * const text = chars + words[this_word].text_start;
                     int chindex = 0;
                     for (;;)
                       {
                         int curch;
-                        if (chindex == this_word->text_length)
+                        if (chindex == words[this_word].text_length)
                             break;
                         if (utblc > MAX_UCS)
                             break;
-                        curch = this_word->text[chindex];
+                        curch = text[chindex];
                         render_one_glyph(vo_font, curch); /* fixme: didn't we already do this? */
                         obj->params.subtitle.utbl[utblc++] = curch;
                         sub_totallen++;
@@ -668,30 +597,11 @@ inline static void vo_update_text_sub
             sub_max_lines = obj->params.subtitle.lines;
         if (sub_max_font_height < vo_font->height)
             sub_max_font_height = vo_font->height;
-        if (sub_max_bottom_font_height < vo_font->pic_b[vo_font->font[40]]->h)
-            sub_max_bottom_font_height = vo_font->pic_b[vo_font->font[40]]->h;
+        if (sub_max_bottom_font_height < vo_font->pic_b[get_font_char(vo_font, 40)->font]->h)
+            sub_max_bottom_font_height = vo_font->pic_b[get_font_char(vo_font, 40)->font]->h;
         if (obj->params.subtitle.lines)
-            obj->topy = movie_height - sub_bottom_margin - (obj->params.subtitle.lines * vo_font->height); /* + vo_font->pic_b[vo_font->font[40]]->h; */
-
-        // free memory
-        if (otp_sub != NULL)
-          {
-            struct osd_text_word *tmp;
-            struct osd_text_line *pmt;
-            for (tmp = otp_sub->words; tmp->next != NULL; free(tmp->prev))
-              {
-                free(tmp->text);
-                tmp = tmp->next;
-              } /*for*/
-            free(tmp->text);
-            free(tmp);
-            for (pmt = otp_sub; pmt->next != NULL; free(pmt->prev))
-              {
-                pmt = pmt->next;
-              } /*for*/
-            free(pmt);
-          }
-        else
+            obj->topy = movie_height - sub_bottom_margin - (obj->params.subtitle.lines * vo_font->height); /* + vo_font->pic_b[get_font_char(vo_font, 40)->font]->h; */
+        if (nrlines == 0)
           {
             fprintf(stderr, "WARN: Subtitles requested but not found.\n");
           } /*if*/
@@ -701,7 +611,7 @@ inline static void vo_update_text_sub
         const int subs_height =
                 (obj->params.subtitle.lines - 1) * vo_font->height
             +
-                vo_font->pic_b[vo_font->font[40]]->h;
+                vo_font->pic_b[get_font_char(vo_font, 40)->font]->h;
       /* fprintf(stderr,"^1 bby1:%d bby2:%d h:%d movie_height:%d oy:%d sa:%d sh:%d f:%d\n",obj->bbox.y1,obj->bbox.y2,h,movie_height,obj->topy,v_sub_alignment,subs_height,font); */
         if (v_sub_alignment == V_SUB_ALIGNMENT_BOTTOM)
             obj->topy = movie_height * sub_pos / 100 - sub_bottom_margin - subs_height;
@@ -781,7 +691,8 @@ inline static void vo_update_text_sub
                 while ((curch = obj->params.subtitle.utbl[chindex++]) != 0)
                   {
                   /* collect the rendered characters of this subtitle display line */
-                    const int font = vo_font->font[curch];
+                    const font_char * const fc = get_font_char(vo_font, curch);
+                    const int font = fc->font;
                     x += kerning(vo_font, prevch, curch);
                     if (font >= 0)
                       {
@@ -791,18 +702,17 @@ inline static void vo_update_text_sub
                             /*obj =*/ obj,
                             /*x0 =*/ x,
                             /*y0 =*/ y,
-                            /*w =*/ vo_font->width[curch],
+                            /*w =*/ fc->width,
                             /*h =*/
                                 vo_font->pic_b[font]->h + y < movie_height - sub_bottom_margin ?
                                     vo_font->pic_b[font]->h
                                 :
                                     movie_height - sub_bottom_margin - y,
-                            /*src =*/ vo_font->pic_b[font]->bmp + vo_font->start[curch],
-                            /*srccolors =*/ vo_font->pic_b[font]->pal,
-                            /*stride =*/ vo_font->pic_b[font]->w
+                            /*image =*/ fc->image,
+                            /*srccolors =*/ vo_font->pic_b[font]->pal
                           );
                       } /*if*/
-                    x += vo_font->width[curch] + vo_font->charspace;
+                    x += fc->width + vo_font->charspace;
                     prevch = curch;
                   } /*while*/
                 if (sub_max_chars < chindex - prev_line_end)
@@ -817,23 +727,67 @@ inline static void vo_update_text_sub
 
 void vo_update_osd(const subtitle_elt * vo_sub)
   {
-    memset(textsub_image_buffer, 0, textsub_image_buffer_size);
-      /* fill with transparent colour */
+    int x1, y1, x2, y2, y;
+    for (y = textsub_image_y0; y < textsub_image_y1; y++)
+      /* clear area used by previous subtitle to transparent colour */
+        memset
+          (
+            textsub_image_buffer + y * movie_width + textsub_image_x0,
+            0,
+            textsub_image_x1 - textsub_image_x0
+          );
     vo_update_text_sub(vo_osd, vo_sub);
+  /* clip bbox to frame */
+    x1 = vo_osd->bbox.x1 > 0 ? vo_osd->bbox.x1 : 0;
+    y1 = vo_osd->bbox.y1 > 0 ? vo_osd->bbox.y1 : 0;
+    x2 = vo_osd->bbox.x2 < movie_width ? vo_osd->bbox.x2 : movie_width;
+    y2 = vo_osd->bbox.y2 < movie_height ? vo_osd->bbox.y2 : movie_height;
+    if (x2 < x1)
+        x2 = x1;
+    if (y2 < y1)
+        y2 = y1;
     vo_draw_subtitle_line
       (
-        /*w =*/ vo_osd->bbox.x2 - vo_osd->bbox.x1,
-        /*h =*/ vo_osd->bbox.y2 - vo_osd->bbox.y1,
-        /*srcbase =*/ vo_osd->bitmap_buffer,
+        /*w =*/ x2 - x1,
+        /*h =*/ y2 - y1,
+        /*srcbase =*/
+                vo_osd->bitmap_buffer
+            +
+                (x1 - vo_osd->bbox.x1)
+            +
+                (y1 - vo_osd->bbox.y1) * vo_osd->stride,
         /*srcstride =*/ vo_osd->stride,
         /*dstbase =*/
                 textsub_image_buffer
             +
-                4 * vo_osd->bbox.x1
+                x1
             +
-                4 * vo_osd->bbox.y1 * movie_width,
-        /*dststride =*/ movie_width * 4
+                y1 * movie_width,
+        /*dststride =*/ movie_width
       );
+  /* keep subpicture alignment the same as if the whole frame had been converted,
+    and keep dimensions even so read_frame doesn't need to add any padding */
+    textsub_image_x0 = x1 & -2;
+    textsub_image_y0 = y1 & -2;
+    textsub_image_x1 = (x2 + 1) & -2;
+    textsub_image_y1 = (y2 + 1) & -2;
+    if (textsub_image_x1 > movie_width)
+        textsub_image_x1 = movie_width;
+    if (textsub_image_y1 > movie_height)
+        textsub_image_y1 = movie_height;
+    if (textsub_image_x1 - textsub_image_x0 < 2)
+      {
+      /* nothing drawn, but still need a (transparent) image */
+        if (textsub_image_x0 > movie_width - 2)
+            textsub_image_x0 = (movie_width - 2) & -2;
+        textsub_image_x1 = textsub_image_x0 + 2;
+      } /*if*/
+    if (textsub_image_y1 - textsub_image_y0 < 2)
+      {
+        if (textsub_image_y0 > movie_height - 2)
+            textsub_image_y0 = (movie_height - 2) & -2;
+        textsub_image_y1 = textsub_image_y0 + 2;
+      } /*if*/
   } /*vo_update_osd*/
 
 void vo_init_osd()
@@ -873,7 +827,7 @@ void vo_init_osd()
         fprintf(stderr, "ERR:  cannot determine default video size and frame rate--no video format specified\n");
         exit(1);
       } /*switch*/
-    textsub_image_buffer_size = sizeof(uint8_t) * 4 * movie_height * movie_width;
+    textsub_image_buffer_size = sizeof(uint8_t) * movie_height * movie_width;
     textsub_image_buffer = malloc(textsub_image_buffer_size);
       /* fixme: not freed from previous call! */
     if (textsub_image_buffer == NULL)
@@ -881,6 +835,13 @@ void vo_init_osd()
         fprintf(stderr, "ERR:  Failed to allocate memory\n");
         exit(1);
       } /*if*/
+    memset(textsub_image_buffer, 0, textsub_image_buffer_size);
+      /* fill with transparent colour index, vo_update_osd only clears what it draws */
+    memset(textsub_image_pal, 0, sizeof textsub_image_pal);
+    textsub_image_x0 = 0;
+    textsub_image_y0 = 0;
+    textsub_image_x1 = 0;
+    textsub_image_y1 = 0;
 #ifdef HAVE_FREETYPE
     init_freetype();
     load_font_ft();
@@ -901,6 +862,9 @@ void vo_finish_osd()
     if (vo_osd)
       {
         free(vo_osd->bitmap_buffer);
+        free(vo_osd->layout.chars);
+        free(vo_osd->layout.words);
+        free(vo_osd->layout.lines);
       } /*if*/
     free(vo_osd);
     vo_osd = NULL;